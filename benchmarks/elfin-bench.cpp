@@ -0,0 +1,327 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+/*
+ * Drives the processor headless through processBlock under a set of loads and
+ * sample rate / block size combinations, and reports time per block, heap
+ * allocations per block (there should be none) and the time from a value
+ * changing to its CC reaching the output buffer. The "state" run times saving and
+ * restoring host state in the binary format against the XML one it replaced, and
+ * the "similarity" run times building and querying the preset similarity index
+ * over a large library.
+ *
+ * elfin-bench [seconds-per-run] [load-name|state|similarity]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "ElfinProcessor.h"
+#include "PatchSimilarity.h"
+
+static std::atomic<bool> countAllocs{false};
+static std::atomic<int64_t> allocCount{0};
+
+void *operator new(std::size_t sz)
+{
+    if (countAllocs.load(std::memory_order_relaxed))
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(sz ? sz : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t sz) { return operator new(sz); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace ec = baconpaul::elfin_controller;
+
+struct Load
+{
+    std::string name;
+    // Called before each block, off the clock, to change values or fill the input
+    std::function<void(ec::ElfinControllerAudioProcessor &, juce::MidiBuffer &, int64_t, int)>
+        prepare;
+};
+
+struct Result
+{
+    double nsPerBlockMean{0}, nsPerBlockWorst{0};
+    double allocsPerBlock{0};
+    std::vector<double> latencyMS;
+};
+
+static double percentile(std::vector<double> &v, double p)
+{
+    if (v.empty())
+        return 0;
+    auto n = (size_t)std::min<double>(v.size() - 1, p * v.size());
+    std::nth_element(v.begin(), v.begin() + n, v.end());
+    return v[n];
+}
+
+static Result run(const Load &load, double sampleRate, int blockSize, double seconds)
+{
+    ec::ElfinControllerAudioProcessor proc;
+    proc.prepareToPlay(sampleRate, blockSize);
+
+    juce::AudioBuffer<float> buffer(2, blockSize);
+    juce::MidiBuffer midi;
+    midi.ensureSize(8192);
+
+    auto &store = proc.devices[0].store;
+    std::array<int8_t, ec::nElfinParams> before{};
+    std::array<int64_t, ec::nElfinParams> changedAt{};
+    changedAt.fill(-1);
+
+    Result res;
+    auto nBlocks = (int64_t)(seconds * sampleRate / blockSize);
+    res.latencyMS.reserve(nBlocks * 4);
+
+    int64_t clock{0}, totalNS{0}, worstNS{0}, totalAllocs{0};
+    for (int64_t b = 0; b < nBlocks; ++b)
+    {
+        midi.clear();
+        for (int i = 0; i < ec::nElfinParams; ++i)
+            before[i] = store.getCC(i);
+
+        load.prepare(proc, midi, b, blockSize);
+
+        // Latency runs from the first unsent change, as the scheduler sees it
+        for (int i = 0; i < ec::nElfinParams; ++i)
+            if (store.getCC(i) != before[i] && changedAt[i] < 0)
+                changedAt[i] = clock;
+
+        allocCount = 0;
+        countAllocs = true;
+        auto st = std::chrono::steady_clock::now();
+        proc.processBlock(buffer, midi);
+        auto en = std::chrono::steady_clock::now();
+        countAllocs = false;
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(en - st).count();
+        totalNS += ns;
+        worstNS = std::max<int64_t>(worstNS, ns);
+        totalAllocs += allocCount;
+
+        for (const auto meta : midi)
+        {
+            auto m = meta.getMessage();
+            if (!m.isController() || m.getChannel() != proc.devices[0].channel)
+                continue;
+            auto idx = ec::controlByCC[m.getControllerNumber() & 0x7F];
+            if (idx < 0 || changedAt[idx] < 0)
+                continue;
+            res.latencyMS.push_back((clock + meta.samplePosition - changedAt[idx]) * 1000.0 /
+                                    sampleRate);
+            changedAt[idx] = -1;
+        }
+        clock += blockSize;
+    }
+
+    res.nsPerBlockMean = (double)totalNS / std::max<int64_t>(nBlocks, 1);
+    res.nsPerBlockWorst = (double)worstNS;
+    res.allocsPerBlock = (double)totalAllocs / std::max<int64_t>(nBlocks, 1);
+    proc.releaseResources();
+    return res;
+}
+
+static void runState(double seconds)
+{
+    // Something like a busy session: a few devices, both morph slots and modulators
+    ec::ElfinControllerAudioProcessor proc;
+    srand(2);
+    proc.setNumDevices(4);
+    for (int d = 0; d < 4; ++d)
+    {
+        proc.setEditDevice(d);
+        proc.randomizePatch(false);
+    }
+    proc.setEditDevice(0);
+    proc.captureMorph(ec::PatchMorph::A);
+    proc.randomizePatch(true);
+    proc.captureMorph(ec::PatchMorph::B);
+    for (int i = 0; i < 2; ++i)
+    {
+        auto &m = proc.modulators.mods[i];
+        m.target = i ? ec::FILT_CUTOFF : ec::LFO_RATE;
+        m.shape = ec::Modulator::STEPS;
+    }
+
+    struct Path
+    {
+        const char *name;
+        std::function<void(juce::MemoryBlock &)> save;
+    };
+    // The XML path is what getStateInformation wrote before the binary state
+    std::vector<Path> paths{{"xml",
+                             [&proc](juce::MemoryBlock &mb)
+                             {
+                                 auto x = proc.toXML(true);
+                                 mb.append(x.c_str(), x.length() + 1);
+                             }},
+                            {"binary", [&proc](juce::MemoryBlock &mb)
+                             { proc.getStateInformation(mb); }}};
+
+    printf("\n%-14s %8s %12s %12s\n", "state", "bytes", "save us", "load us");
+    for (auto &p : paths)
+    {
+        juce::MemoryBlock mb;
+        p.save(mb);
+
+        int n{0};
+        double saveUS{0}, loadUS{0};
+        auto until = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+        while (std::chrono::steady_clock::now() < until)
+        {
+            juce::MemoryBlock s;
+            auto st = std::chrono::steady_clock::now();
+            p.save(s);
+            auto mid = std::chrono::steady_clock::now();
+            proc.setStateInformation(mb.getData(), (int)mb.getSize());
+            auto en = std::chrono::steady_clock::now();
+            saveUS += std::chrono::duration<double, std::micro>(mid - st).count();
+            loadUS += std::chrono::duration<double, std::micro>(en - mid).count();
+            n++;
+        }
+        printf("%-14s %8zu %12.2f %12.2f\n", p.name, mb.getSize(), saveUS / std::max(n, 1),
+               loadUS / std::max(n, 1));
+    }
+}
+
+static void runSimilarity(double seconds)
+{
+    // A big shared library: random patches with a few copies scattered through
+    srand(3);
+    std::vector<ec::PatchCCs> library(100000);
+    for (size_t i = 0; i < library.size(); ++i)
+    {
+        if (i % 1000 == 999)
+        {
+            library[i] = library[i / 1000];
+            continue;
+        }
+        for (auto &c : library[i])
+            c = (int16_t)(rand() % 128);
+    }
+
+    printf("\n%-14s %8s %12s %12s %10s\n", "similarity", "patches", "build ms", "query ms",
+           "dup sets");
+    ec::PatchSimilarity sim;
+    int n{0};
+    double buildMS{0}, queryMS{0};
+    auto until = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while (std::chrono::steady_clock::now() < until)
+    {
+        auto st = std::chrono::steady_clock::now();
+        sim.build({}, library);
+        auto mid = std::chrono::steady_clock::now();
+        if (sim.nearestTo(n % (int)library.size()).empty())
+            printf("No neighbours found\n");
+        auto en = std::chrono::steady_clock::now();
+        buildMS += std::chrono::duration<double, std::milli>(mid - st).count();
+        queryMS += std::chrono::duration<double, std::milli>(en - mid).count();
+        n++;
+    }
+    printf("%-14s %8zu %12.2f %12.3f %10zu\n", "100k", library.size(), buildMS / std::max(n, 1),
+           queryMS / std::max(n, 1), sim.duplicateGroups().size());
+}
+
+int main(int argc, char **argv)
+{
+    juce::ScopedJuceInitialiser_GUI juceInit;
+
+    double seconds = argc > 1 ? std::atof(argv[1]) : 5.0;
+    std::string only = argc > 2 ? argv[2] : "";
+
+    // Two different patches to flip between for the patch load
+    std::string patchA, patchB;
+    {
+        ec::ElfinControllerAudioProcessor proc;
+        srand(1);
+        proc.randomizePatch(false);
+        patchA = proc.toXML();
+        proc.randomizePatch(false);
+        patchB = proc.toXML();
+    }
+
+    std::vector<Load> loads;
+    loads.push_back({"idle", [](auto &, auto &, auto, auto) {}});
+    loads.push_back({"automate-one",
+                     [](auto &proc, auto &, auto b, auto)
+                     {
+                         auto v = 0.5f + 0.5f * std::sin(b * 0.05f);
+                         proc.params[ec::FILT_CUTOFF]->setValueNotifyingHost(v);
+                     }});
+    loads.push_back({"patch-load",
+                     [&patchA, &patchB](auto &proc, auto &, auto b, auto)
+                     { proc.fromXML(b % 2 ? patchB : patchA); }});
+    loads.push_back({"randomize",
+                     [](auto &proc, auto &, auto, auto) { proc.randomizePatch(false); }});
+    loads.push_back({"note-stream",
+                     [](auto &proc, auto &midi, auto b, auto bs)
+                     {
+                         // A note every 128 samples, on for 64, keeps the wire about
+                         // three quarters busy at 48k. Add a slow param move on top.
+                         for (int s = 0; s < bs; ++s)
+                         {
+                             auto at = b * bs + s;
+                             auto n = 36 + (int)(at / 128 % 48);
+                             if (at % 128 == 0)
+                                 midi.addEvent(juce::MidiMessage::noteOn(1, n, (juce::uint8)100),
+                                               s);
+                             else if (at % 128 == 64)
+                                 midi.addEvent(juce::MidiMessage::noteOff(1, n), s);
+                         }
+                         if (b % 8 == 0)
+                             proc.params[ec::FILT_RESONANCE]->setValueNotifyingHost(
+                                 (b / 8 % 128) / 127.f);
+                     }});
+
+    if (only != "state" && only != "similarity")
+        printf("%-14s %7s %6s %12s %12s %9s %8s %8s %8s %8s\n", "load", "sr", "block",
+               "ns/blk", "worst ns", "alloc/blk", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (auto &l : loads)
+    {
+        if (!only.empty() && only != l.name)
+            continue;
+        for (auto sr : {44100.0, 48000.0, 96000.0})
+        {
+            for (auto bs : {32, 64, 256, 1024})
+            {
+                auto r = run(l, sr, bs, seconds);
+                printf("%-14s %7.0f %6d %12.0f %12.0f %9.2f %8.2f %8.2f %8.2f %8.2f\n",
+                       l.name.c_str(), sr, bs, r.nsPerBlockMean, r.nsPerBlockWorst,
+                       r.allocsPerBlock, percentile(r.latencyMS, 0.5),
+                       percentile(r.latencyMS, 0.9), percentile(r.latencyMS, 0.99),
+                       percentile(r.latencyMS, 1.0));
+            }
+        }
+    }
+
+    if (only.empty() || only == "state")
+        runState(seconds);
+    if (only.empty() || only == "similarity")
+        runSimilarity(seconds);
+    return 0;
+}
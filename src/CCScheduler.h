@@ -0,0 +1,264 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_CCSCHEDULER_H
+#define ELFIN_CONTROLLER_CCSCHEDULER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace baconpaul::elfin_controller
+{
+inline int lowestSetBit(uint64_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return (int)idx;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+/*
+ * Decides which pending CC gets the next slot on the wire. Params fall in to
+ * priority classes: whatever the user (or host) has a gesture open on, then the
+ * params which matter most to the sound, then everything else. Inside a class
+ * we round-robin so a burst can't park a param at the back of the enum forever,
+ * and any param which has waited longer than the deadline jumps the queue, so
+ * edit-to-wire time is bounded by deadline plus one full patch of wire time.
+ *
+ * Each param can also carry a maximum send rate. A param which went out more
+ * recently than that is held (but stays pending) so dense automation is thinned
+ * to the latest value at the allowed rate. Ending a gesture lifts the hold so the
+ * final value always goes straight away.
+ *
+ * All of this runs on the audio thread except setTouched, which is atomic.
+ */
+struct CCScheduler
+{
+    enum Priority : uint8_t
+    {
+        TOUCHED,
+        SOUND_CRITICAL,
+        NORMAL,
+
+        numPriorities
+    };
+
+    static constexpr int maxParams{64};
+    static constexpr double deadlineInMS{40.0};
+
+    CCScheduler()
+    {
+        maxRateHz.fill(0.f);
+        minIntervalSamples.fill(0);
+        lastSentAt.fill(neverSent);
+    }
+
+    void setSampleRate(double sr)
+    {
+        sampleRate = sr;
+        deadlineSamples = (int64_t)(sr * deadlineInMS / 1000.0);
+        for (int i = 0; i < maxParams; ++i)
+            setMaxRate(i, maxRateHz[i]);
+    }
+
+    // 0 means as fast as the wire allows
+    void setMaxRate(int idx, float hz)
+    {
+        maxRateHz[idx] = hz;
+        minIntervalSamples[idx] = hz > 0 ? (int64_t)(sampleRate / hz) : 0;
+    }
+
+    void setPriority(int idx, Priority p)
+    {
+        auto bit = 1ULL << idx;
+        for (auto &m : classMask)
+            m &= ~bit;
+        classMask[p] |= bit;
+    }
+
+    void setTouched(int idx, bool isTouched)
+    {
+        if (idx < 0 || idx >= maxParams)
+            return;
+        auto bit = 1ULL << idx;
+        if (isTouched)
+            touchedMask.fetch_or(bit, std::memory_order_relaxed);
+        else
+            touchedMask.fetch_and(~bit, std::memory_order_relaxed);
+    }
+
+    // Start a block with the set of params which currently need sending
+    void beginBlock(uint64_t pendingParams, int64_t nowSample)
+    {
+        now = nowSample;
+        auto priorTouched = touched;
+        touched = touchedMask.load(std::memory_order_relaxed);
+
+        // a gesture just ended so let the final value straight through
+        auto released = priorTouched & ~touched;
+        while (released)
+        {
+            auto idx = lowestSetBit(released);
+            released &= released - 1;
+            lastSentAt[idx] = neverSent;
+        }
+
+        // anything newly pending starts its clock now. Anything which was pending
+        // and got sent by someone else (a resend, a reset) stops being tracked.
+        tracked &= pendingParams;
+        auto fresh = pendingParams & ~tracked;
+        while (fresh)
+        {
+            auto idx = lowestSetBit(fresh);
+            fresh &= fresh - 1;
+            dirtySince[idx] = now;
+        }
+        tracked |= pendingParams;
+
+        held = 0;
+        auto walk = pendingParams;
+        while (walk)
+        {
+            auto idx = lowestSetBit(walk);
+            walk &= walk - 1;
+            if (now - lastSentAt[idx] < minIntervalSamples[idx])
+                held |= 1ULL << idx;
+        }
+        pending = pendingParams & ~held;
+    }
+
+    bool isHeld(int idx) const { return held & (1ULL << idx); }
+
+    int64_t minIntervalFor(int idx) const { return minIntervalSamples[idx]; }
+    // The earliest sample at which idx is outside its rate limit
+    int64_t readyAt(int idx) const { return lastSentAt[idx] + minIntervalSamples[idx]; }
+
+    // Take params out of the running for next() this block without changing their
+    // tracking, for callers who want to place them on the wire themselves
+    void setAside(uint64_t mask) { pending &= ~mask; }
+
+    // The param to send next, or -1 if nothing is pending and outside its rate limit
+    int next()
+    {
+        if (!pending)
+            return -1;
+
+        // Overdue params go first, oldest first
+        if (deadlineSamples > 0)
+        {
+            int oldest{-1};
+            auto walk = pending;
+            while (walk)
+            {
+                auto idx = lowestSetBit(walk);
+                walk &= walk - 1;
+                if (now - dirtySince[idx] >= deadlineSamples &&
+                    (oldest < 0 || dirtySince[idx] < dirtySince[oldest]))
+                {
+                    oldest = idx;
+                }
+            }
+            if (oldest >= 0)
+            {
+                pickedClass = -1;
+                return oldest;
+            }
+        }
+
+        for (int c = 0; c < numPriorities; ++c)
+        {
+            uint64_t m{0};
+            switch (c)
+            {
+            case TOUCHED:
+                m = pending & touched;
+                break;
+            case SOUND_CRITICAL:
+                m = pending & classMask[c];
+                break;
+            default:
+                m = pending;
+                break;
+            }
+            if (!m)
+                continue;
+
+            // The cursor only moves on in sent(), so a param the wire refuses keeps
+            // its turn
+            auto rotated = m & (~0ULL << cursor[c]);
+            auto idx = lowestSetBit(rotated ? rotated : m);
+            picked = idx;
+            pickedClass = c;
+            return idx;
+        }
+        return -1;
+    }
+
+    // The param returned by next() made it on to the wire at sample atSample
+    void sent(int idx, int64_t atSample)
+    {
+        if (idx == picked)
+        {
+            if (pickedClass >= 0)
+                cursor[pickedClass] = (idx + 1) % maxParams;
+            picked = -1;
+        }
+
+        auto bit = 1ULL << idx;
+        pending &= ~bit;
+        tracked &= ~bit;
+        lastSentAt[idx] = atSample;
+
+        auto lat = atSample - dirtySince[idx];
+        if (lat > worstLatencySamples.load(std::memory_order_relaxed))
+            worstLatencySamples.store(lat, std::memory_order_relaxed);
+        lastLatencySamples.store(lat, std::memory_order_relaxed);
+    }
+
+    double worstLatencyInMS() const { return worstLatencySamples * 1000.0 / sampleRate; }
+    double lastLatencyInMS() const { return lastLatencySamples * 1000.0 / sampleRate; }
+    void resetLatencyStats()
+    {
+        worstLatencySamples = 0;
+        lastLatencySamples = 0;
+    }
+
+    std::atomic<uint64_t> touchedMask{0};
+    std::atomic<int64_t> worstLatencySamples{0}, lastLatencySamples{0};
+
+  protected:
+    double sampleRate{48000};
+    int64_t deadlineSamples{0};
+    std::array<uint64_t, numPriorities> classMask{};
+    std::array<int, numPriorities> cursor{};
+    int picked{-1}, pickedClass{-1};
+    std::array<int64_t, maxParams> dirtySince{};
+
+    static constexpr int64_t neverSent{std::numeric_limits<int64_t>::min() / 2};
+    std::array<float, maxParams> maxRateHz{};
+    std::array<int64_t, maxParams> minIntervalSamples{}, lastSentAt{};
+
+    int64_t now{0};
+    uint64_t pending{0}, tracked{0}, touched{0}, held{0};
+};
+} // namespace baconpaul::elfin_controller
+#endif // CCSCHEDULER_H
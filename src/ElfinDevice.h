@@ -0,0 +1,42 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_ELFINDEVICE_H
+#define ELFIN_CONTROLLER_ELFINDEVICE_H
+
+#include <atomic>
+
+#include "configuration.h"
+#include "ParamStore.h"
+#include "CCScheduler.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * One physical Elfin on the port. Each has its own channel, CC state and
+ * scheduler; they all share the processor's pacer since they share the wire.
+ */
+struct ElfinDevice
+{
+    static constexpr int maxDevices{16};
+
+    std::atomic<int> channel{1}; // 1 based, like juce::MidiMessage
+    std::atomic<bool> sendAllNotesOff{false};
+
+    ParamStore store;
+    CCScheduler scheduler;
+
+    uint8_t ccStatus() const { return (uint8_t)(0xB0 | ((channel - 1) & 0x0F)); }
+};
+} // namespace baconpaul::elfin_controller
+#endif // ELFINDEVICE_H
@@ -0,0 +1,344 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#include "ElfinEngine.h"
+
+#include <algorithm>
+
+namespace baconpaul::elfin_controller
+{
+ElfinEngine::ElfinEngine()
+{
+    for (int d = 0; d < ElfinDevice::maxDevices; ++d)
+    {
+        devices[d].channel = d + 1;
+    }
+    rebuildDeviceByChannel();
+
+    for (const auto &cc : elfinConfig)
+    {
+        auto id = cc.control;
+        for (auto &dev : devices)
+        {
+            dev.store.initCC(id, cc.midiCCDefault);
+            dev.store.setRange(id, cc.midiCCStart, cc.midiCCEnd);
+            dev.scheduler.setPriority(id, cc.isSoundCritical ? CCScheduler::SOUND_CRITICAL
+                                                             : CCScheduler::NORMAL);
+            dev.scheduler.setMaxRate(id, cc.maxCCRateHz);
+        }
+    }
+}
+
+void ElfinEngine::setEngineSampleRate(double sr)
+{
+    pacer.setSampleRate(sr);
+    for (auto &dev : devices)
+        dev.scheduler.setSampleRate(sr);
+}
+
+void ElfinEngine::setDeviceCount(int n)
+{
+    n = std::clamp(n, 1, ElfinDevice::maxDevices);
+    auto was = numDevices.load();
+    if (n == was)
+        return;
+
+    // Freshly added devices get a full patch
+    for (int d = was; d < n; ++d)
+    {
+        devices[d].store.markAllDirty();
+        devices[d].sendAllNotesOff = true;
+    }
+    numDevices = n;
+    rebuildDeviceByChannel();
+}
+
+void ElfinEngine::setDeviceChannel(int d, int channel)
+{
+    channel = std::clamp(channel, 1, 16);
+    if (d < 0 || d >= ElfinDevice::maxDevices || devices[d].channel == channel)
+        return;
+
+    devices[d].channel = channel;
+    devices[d].store.markAllDirty();
+    devices[d].sendAllNotesOff = true;
+    rebuildDeviceByChannel();
+}
+
+void ElfinEngine::rebuildDeviceByChannel()
+{
+    for (auto &c : deviceByChannel)
+        c = -1;
+    // lowest device wins if two share a channel
+    for (int d = numDevices - 1; d >= 0; --d)
+        deviceByChannel[devices[d].channel - 1] = (int8_t)d;
+}
+
+void ElfinEngine::beginEngineBlock(const BlockInfo &bi)
+{
+    wakeMessageThread = false;
+    if (!motionRecorder.isIdle())
+    {
+        motionRecorder.beginBlock(bi.transportPlaying, bi.ppq, bi.bpm, bi.sampleRate,
+                                  bi.numSamples);
+    }
+    pacer.beginBlock(bi.numSamples);
+}
+
+bool ElfinEngine::receiveMidi(int sample, const uint8_t *data, int size)
+{
+    pacer.addFixedEvent(sample, data, size);
+
+    // Our own CCs coming back from a device or a controller. They still pass
+    // through, but the store takes the value so we don't send it again
+    if (size != 3 || (data[0] & 0xF0) != 0xB0)
+        return false;
+
+    auto nDev = std::clamp(numDevices.load(), 1, ElfinDevice::maxDevices);
+    auto dev = deviceByChannel[data[0] & 0x0F].load(std::memory_order_relaxed);
+    auto idx = controlByCC[data[1] & 0x7F];
+    if (dev < 0 || dev >= nDev || idx < 0)
+        return false;
+
+    auto v = (int8_t)(data[2] & 0x7F);
+    devices[dev].store.setFromWire(idx, v);
+    fromHardware.push({(int8_t)dev, idx, v});
+    if (dev == editDevice)
+        motionRecorder.record(idx, v, sample);
+    wakeMessageThread = true;
+    return true;
+}
+
+bool ElfinEngine::finishEngineBlock(const BlockInfo &bi, MidiSink &out)
+{
+    auto nDev = std::clamp(numDevices.load(), 1, ElfinDevice::maxDevices);
+    auto &editStore = devices[editDevice].store;
+
+    if (morph.isReady())
+    {
+        auto m = bi.morph;
+        if (morphRebase.exchange(false))
+        {
+            lastMorph = m;
+        }
+        else if (m != lastMorph)
+        {
+            lastMorph = m;
+            if (morph.apply(m, editStore) > 0)
+            {
+                syncParamsFromStore = true;
+                wakeMessageThread = true;
+            }
+        }
+    }
+
+    bool anyPlayed{false};
+    motionRecorder.play(
+        [&](int idx, int8_t v, int at)
+        {
+            if (editStore.setCC(idx, v))
+            {
+                editStore.setTimed(idx, at);
+                anyPlayed = true;
+            }
+        });
+    if (anyPlayed)
+    {
+        syncParamsFromStore = true;
+        wakeMessageThread = true;
+    }
+
+    if (sendAllNotesOff.exchange(false))
+    {
+        for (int d = 0; d < nDev; ++d)
+            devices[d].sendAllNotesOff = true;
+    }
+
+    for (int d = 0; d < nDev; ++d)
+    {
+        devices[d].store.claimDirty();
+    }
+
+    if (modulators.anyActive())
+    {
+        // Follow the host when it's playing and free run at its tempo when it's not
+        if (bi.bpm > 0)
+            modulatorBPM = bi.bpm;
+        if (bi.transportPlaying)
+            modulatorBeat = bi.ppq;
+
+        auto ccInterval = pacer.samplesFor(3);
+        modulators.process(
+            modulatorBeat, sampleClock,
+            [&](int d, int idx)
+            {
+                auto &dev = devices[d];
+                return !(dev.store.pending & (1ULL << idx)) &&
+                       sampleClock >= dev.scheduler.readyAt(idx);
+            },
+            [&](int d, int idx)
+            { return std::max<int64_t>(devices[d].scheduler.minIntervalFor(idx), ccInterval); },
+            [&](int d, int idx, int off) { devices[d].store.setModOffset(idx, off); });
+
+        modulatorBeat += modulatorBPM / 60.0 / bi.sampleRate * bi.numSamples;
+    }
+
+    // Everything which changed on the edit device since last block, from the UI, the
+    // host or the morph, is a move the recorder wants. Host changes keep their offset.
+    auto fresh = editStore.claimed;
+    while (fresh)
+    {
+        auto idx = lowestSetBit(fresh);
+        fresh &= fresh - 1;
+        auto at = (editStore.timed >> idx) & 1 ? editStore.timedSample[idx] : 0;
+        motionRecorder.record(idx, editStore.getCC(idx), at);
+    }
+
+    // Rotate who goes first so one busy device can't starve the others of wire
+    firstDevice = (firstDevice + 1) % nDev;
+    for (int i = 0; i < nDev; ++i)
+    {
+        if (!emitDevice(devices[(firstDevice + i) % nDev], out, bi.numSamples))
+            break;
+    }
+
+    // Sample offsets only mean something in the block they came in. Anything timed we
+    // couldn't place, or didn't get to, goes out untimed next block.
+    for (int d = 0; d < nDev; ++d)
+    {
+        devices[d].store.timed = 0;
+    }
+
+    pacer.endBlock();
+    sampleClock += bi.numSamples;
+
+    return wakeMessageThread;
+}
+
+bool ElfinEngine::emitDevice(ElfinDevice &dev, MidiSink &out, int numSamples)
+{
+    auto &store = dev.store;
+    auto &scheduler = dev.scheduler;
+    auto ccStatus = dev.ccStatus();
+
+    if (dev.sendAllNotesOff)
+    {
+        auto at = pacer.schedule(ccStatus, 3);
+        if (at < 0)
+        {
+            // The wire is still busy. Hold everything back so the all notes off
+            // still precedes the patch.
+            return false;
+        }
+        dev.sendAllNotesOff = false;
+        uint8_t msg[3]{ccStatus, 123, 0};
+        out.addEvent(msg, 3, at);
+    }
+
+    // A value which is already the last one on the wire, like a UI edit back to what
+    // the device just told us, needn't go again unless it is being forced out
+    auto same = store.pending & ~store.forcedPending;
+    while (same)
+    {
+        auto idx = lowestSetBit(same);
+        same &= same - 1;
+        if (store.valueForSend(idx) == store.lastSent[idx])
+        {
+            store.pending &= ~(1ULL << idx);
+            store.timed &= ~(1ULL << idx);
+        }
+    }
+
+    auto pending = store.pending;
+    scheduler.beginBlock(pending, sampleClock);
+    if (!pending)
+        return true;
+
+    auto sendParam = [&](int idx, int at)
+    {
+        uint8_t msg[3]{ccStatus, (uint8_t)elfinConfig[idx].midiCC,
+                       (uint8_t)store.takeForSend(idx)};
+        out.addEvent(msg, 3, at);
+        scheduler.sent(idx, sampleClock + at);
+    };
+
+    // Changes the host placed at a time inside this block go out at (or as near as the
+    // wire allows to) that sample, so take them out of the general scan in time order
+    std::array<int, nElfinParams> timedOrder;
+    int nTimed{0}, tpos{0};
+    auto timed = store.timed & pending;
+    scheduler.setAside(timed);
+    while (timed)
+    {
+        auto idx = lowestSetBit(timed);
+        timed &= timed - 1;
+        if (scheduler.isHeld(idx))
+            continue;
+        auto &ts = store.timedSample;
+        ts[idx] = std::clamp(ts[idx], 0, numSamples - 1);
+        int pos = nTimed++;
+        while (pos > 0 && ts[timedOrder[pos - 1]] > ts[idx])
+        {
+            timedOrder[pos] = timedOrder[pos - 1];
+            pos--;
+        }
+        timedOrder[pos] = idx;
+    }
+
+    auto sendNextTimed = [&]()
+    {
+        auto idx = timedOrder[tpos];
+        auto at = pacer.schedule(ccStatus, 3, store.timedSample[idx]);
+        if (at < 0)
+            return false;
+        sendParam(idx, at);
+        tpos++;
+        return true;
+    };
+
+    auto ccSamples = pacer.samplesFor(3);
+    bool wireFull{false};
+    int idx;
+    while (!wireFull && (idx = scheduler.next()) >= 0)
+    {
+        // Don't let general traffic push a timed change late
+        while (tpos < nTimed &&
+               store.timedSample[timedOrder[tpos]] <= pacer.nextFreeSample() + ccSamples)
+        {
+            if (!sendNextTimed())
+            {
+                wireFull = true;
+                break;
+            }
+        }
+        if (wireFull)
+            break;
+
+        auto at = pacer.schedule(ccStatus, 3);
+        if (at < 0)
+        {
+            // Out of wire for this block; the rest stay pending and go next time
+            wireFull = true;
+            break;
+        }
+        sendParam(idx, at);
+    }
+
+    while (!wireFull && tpos < nTimed)
+    {
+        wireFull = !sendNextTimed();
+    }
+
+    return !wireFull;
+}
+} // namespace baconpaul::elfin_controller
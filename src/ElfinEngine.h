@@ -0,0 +1,133 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_ELFINENGINE_H
+#define ELFIN_CONTROLLER_ELFINENGINE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "configuration.h"
+#include "MidiPacer.h"
+#include "CCScheduler.h"
+#include "ParamStore.h"
+#include "ElfinDevice.h"
+#include "PatchMorph.h"
+#include "MotionRecorder.h"
+#include "Modulators.h"
+#include "SPSCQueue.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * Where the engine puts the MIDI it generates. The plugin adapts a juce::MidiBuffer;
+ * the bench and tools can collect straight in to an array.
+ */
+struct MidiSink
+{
+    virtual ~MidiSink() = default;
+    virtual void addEvent(const uint8_t *data, int size, int sample) = 0;
+};
+
+/*
+ * Everything the audio thread does, without JUCE. The engine owns the devices and
+ * their CC state, the wire pacing and the morph, recorder and modulators which
+ * feed it. A host wrapper gives it the block's transport and input MIDI and takes
+ * the output. Changes that the host params need to hear about are flagged in
+ * syncParamsFromStore and hardware CCs are queued in fromHardware, both for the
+ * message thread.
+ *
+ * A block is beginEngineBlock, then receiveMidi for each input event in order,
+ * then finishEngineBlock. finishEngineBlock returns true if the message thread
+ * should be woken.
+ */
+struct ElfinEngine
+{
+    ElfinEngine();
+
+    void setEngineSampleRate(double sr);
+
+    struct BlockInfo
+    {
+        int numSamples{0};
+        double sampleRate{48000};
+        bool transportPlaying{false};
+        double ppq{0}, bpm{0};
+        float morph{0};
+    };
+
+    // Do the recorder or modulators want BlockInfo to carry the transport?
+    bool needsTransport() const { return !motionRecorder.isIdle() || modulators.anyActive(); }
+
+    void beginEngineBlock(const BlockInfo &);
+    // Returns true if this was a CC for one of our params on one of our devices
+    bool receiveMidi(int sample, const uint8_t *data, int size);
+    bool finishEngineBlock(const BlockInfo &, MidiSink &);
+
+    /*
+     * We can drive several Elfins on one port, each on its own channel. The host
+     * params are bound to the edit device; the others keep their state in their
+     * store and are reached by switching the edit device.
+     */
+    std::array<ElfinDevice, ElfinDevice::maxDevices> devices;
+    std::atomic<int> numDevices{1}, editDevice{0};
+    int firstDevice{0};
+    std::array<std::atomic<int8_t>, 16> deviceByChannel;
+
+    void setDeviceCount(int n);
+    void setDeviceChannel(int d, int channel);
+    void rebuildDeviceByChannel();
+
+    std::atomic<bool> sendAllNotesOff{false};
+
+    /*
+     * CCs which arrive from the hardware (or a controller) for one of our params are
+     * applied to the store on the audio thread and queued here for the message
+     * thread to push to the params and the host.
+     */
+    struct HardwareCCMsg
+    {
+        int8_t device;
+        int8_t param;
+        int8_t value;
+    };
+    SPSCQueue<HardwareCCMsg, 1024> fromHardware;
+
+    MidiPacer pacer;
+    int64_t sampleClock{0};
+
+    /*
+     * Morph blends the edit device between two captured patches. The audio thread
+     * writes the blend in to the store; the message thread then brings the host
+     * params in line.
+     */
+    PatchMorph morph;
+    float lastMorph{-1.f};
+    std::atomic<bool> morphRebase{false}, syncParamsFromStore{false};
+
+    MotionRecorder motionRecorder;
+
+    /*
+     * Modulators add a tempo synced offset to a target's CC at send time. They
+     * follow the host beat while it plays and free run at the last tempo when not.
+     */
+    ModulatorBank modulators;
+    double modulatorBeat{0}, modulatorBPM{120};
+
+  protected:
+    bool emitDevice(ElfinDevice &, MidiSink &, int numSamples);
+    bool wakeMessageThread{false};
+};
+} // namespace baconpaul::elfin_controller
+#endif // ELFINENGINE_H
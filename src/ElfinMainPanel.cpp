@@ -70,20 +70,22 @@ ElfinMainPanel::ElfinMainPanel(ElfinControllerAudioProcessor &p) : jcmp::WindowP
             w->initPatch();
             break;
         case 1:
+            w->processor.applyPatchCCs(w->presetManager->factoryPatchCCs(idx));
+            break;
+        case 2:
         {
-            const std::string s = w->presetManager->factoryXMLFor(idx);
-            if (!s.empty())
-            {
-                w->processor.fromXML(s);
-            }
+            auto ccs = emptyPatchCCs();
+            if (w->presetManager->currentUserPatchCCs(idx, ccs))
+                w->processor.applyPatchCCs(ccs);
+            else
+                w->loadFromFile(p);
         }
         break;
-        case 2:
-            w->loadFromFile(p);
-            break;
         }
+        w->processor.presetName = w->presetDataBinding->getNameFor(w->presetDataBinding->curr);
         w->repaint();
     };
+    showSessionPreset();
 
     presetButton = std::make_unique<PresetButton>();
     presetButton->setCustomClass(PatchMenu);
@@ -225,6 +227,27 @@ void ElfinMainPanel::onIdle()
         processor.refreshUI = false;
     }
 
+    if (presetManager->userScanReady())
+    {
+        // Keep the same user patch selected wherever the rescan put it
+        auto was = presetDataBinding->selectedUserPatch();
+        if (presetManager->takeUserScan())
+        {
+            // A session's user patch can't be found until the first scan is in
+            if (was.empty() && presetDataBinding->hasExtra)
+                showSessionPreset();
+            else
+                presetDataBinding->reselectUserPatch(was);
+            doRepaint = true;
+        }
+    }
+
+    if (processor.presetNameRestored)
+    {
+        showSessionPreset();
+        doRepaint = true;
+    }
+
     if (doRepaint)
     {
         settingsPanel->resetUnison();
@@ -241,6 +264,13 @@ void ElfinMainPanel::onIdle()
     }
 }
 
+void ElfinMainPanel::showSessionPreset()
+{
+    processor.presetNameRestored = false;
+    if (!processor.presetName.empty())
+        presetDataBinding->setStateForDisplayName(processor.presetName);
+}
+
 void ElfinMainPanel::loadPatch()
 {
     setupUserPath();
@@ -345,10 +375,10 @@ void ElfinMainPanel::updateToolTip(ElfinControllerAudioProcessor::float_param_t
     row_t val;
     val.centerAlignText = std::to_string(p->getCC());
 
-    if (p->getCC() == p->desc.midiCCStart && !p->desc.midiCCStartLabel.empty())
-        val.centerAlignText += " (" + p->desc.midiCCStartLabel + ")";
-    if (p->getCC() == p->desc.midiCCEnd && !p->desc.midiCCEndLabel.empty())
-        val.centerAlignText += " (" + p->desc.midiCCEndLabel + ")";
+    if (p->getCC() == p->desc.midiCCStart && *p->desc.midiCCStartLabel)
+        val.centerAlignText += std::string(" (") + p->desc.midiCCStartLabel + ")";
+    if (p->getCC() == p->desc.midiCCEnd && *p->desc.midiCCEndLabel)
+        val.centerAlignText += std::string(" (") + p->desc.midiCCEndLabel + ")";
 
     val.centerIsMonospace = true;
     rows.push_back(val);
@@ -420,14 +450,7 @@ void ElfinMainPanel::setupStyle()
                   juce::Colour(0x20, 0x20, 0x20));
 }
 
-void ElfinMainPanel::initPatch()
-{
-    for (auto p : processor.params)
-    {
-        auto f = p->getFloatForCC(p->desc.midiCCDefault);
-        p->setValueNotifyingHost(f);
-    }
-}
+void ElfinMainPanel::initPatch() { processor.initPatch(); }
 
 void ElfinMainPanel::loadFromFile(const juce::File &jf)
 {
@@ -495,6 +518,8 @@ void ElfinMainPanel::loadFromFile(const fs::path &p)
 
 void ElfinMainPanel::showElfinMainMenu()
 {
+    updatePresetMenus();
+
     auto m = juce::PopupMenu();
     m.addSectionHeader("Manage");
 
@@ -527,6 +552,22 @@ void ElfinMainPanel::showElfinMainMenu()
                   w->presetDataBinding->setValueFromGUI(0);
               });
 
+    {
+        auto &sim = presetManager->similarity();
+        auto &pdb = *presetDataBinding;
+
+        // Near the loaded preset, or near what we have if it has been edited
+        auto at = pdb.isDirty ? -1 : pdb.getValue() - 1;
+        auto near =
+            sim.isValid(at) ? sim.nearestTo(at) : sim.nearest(processor.currentPatchCCs());
+        auto sm = juce::PopupMenu();
+        for (auto &n : near)
+            sm.addItem(presetMenuIdBase + 1 + n.index,
+                       catalogueLabel(n.index) + (n.distance == 0 ? " (identical)" : ""));
+        m.addSubMenu("Similar Patches", sm, !near.empty());
+        m.addSubMenu("Duplicate Patches", presetMenus.duplicates, presetMenus.hasDuplicates);
+    }
+
     m.addSeparator();
 
     m.addItem("Resend Patch To Device",
@@ -534,8 +575,9 @@ void ElfinMainPanel::showElfinMainMenu()
               {
                   if (!w)
                       return;
-                  for (auto p : w->processor.params)
-                      p->invalid = true;
+                  auto &proc = w->processor;
+                  for (int d = 0; d < proc.numDevices; ++d)
+                      proc.devices[d].store.markAllDirty();
               });
     m.addItem("Send All Notes Off",
               [w = juce::Component::SafePointer(this)]()
@@ -545,6 +587,168 @@ void ElfinMainPanel::showElfinMainMenu()
                   w->processor.sendAllNotesOff = true;
               });
 
+    auto devs = juce::PopupMenu();
+    for (int d = 0; d < processor.numDevices; ++d)
+    {
+        auto lab = "Edit Elfin " + std::to_string(d + 1) + " (Ch " +
+                   std::to_string(processor.devices[d].channel.load()) + ")";
+        devs.addItem(lab, true, d == processor.editDevice,
+                     [w = juce::Component::SafePointer(this), d]()
+                     {
+                         if (!w)
+                             return;
+                         w->processor.setEditDevice(d);
+                         w->repaint();
+                     });
+    }
+    devs.addSeparator();
+    auto chans = juce::PopupMenu();
+    for (int c = 1; c <= 16; ++c)
+    {
+        chans.addItem("Channel " + std::to_string(c), true,
+                      processor.devices[processor.editDevice].channel == c,
+                      [w = juce::Component::SafePointer(this), c]()
+                      {
+                          if (!w)
+                              return;
+                          w->processor.setDeviceChannel(w->processor.editDevice, c);
+                      });
+    }
+    devs.addSubMenu("Edited Elfin MIDI Channel", chans);
+    devs.addItem("Add Elfin", processor.numDevices < ElfinDevice::maxDevices, false,
+                 [w = juce::Component::SafePointer(this)]()
+                 {
+                     if (!w)
+                         return;
+                     w->processor.setNumDevices(w->processor.numDevices + 1);
+                 });
+    devs.addItem("Remove Last Elfin", processor.numDevices > 1, false,
+                 [w = juce::Component::SafePointer(this)]()
+                 {
+                     if (!w)
+                         return;
+                     w->processor.setNumDevices(w->processor.numDevices - 1);
+                     w->repaint();
+                 });
+    m.addSubMenu("Devices", devs);
+
+    auto mor = juce::PopupMenu();
+    mor.addItem("Capture Current As Morph A", true, processor.morph.hasCaptured(PatchMorph::A),
+                [w = juce::Component::SafePointer(this)]()
+                {
+                    if (w)
+                        w->processor.captureMorph(PatchMorph::A);
+                });
+    mor.addItem("Capture Current As Morph B", true, processor.morph.hasCaptured(PatchMorph::B),
+                [w = juce::Component::SafePointer(this)]()
+                {
+                    if (w)
+                        w->processor.captureMorph(PatchMorph::B);
+                });
+    mor.addItem("Clear Morph", processor.morph.isReady(), false,
+                [w = juce::Component::SafePointer(this)]()
+                {
+                    if (w)
+                        w->processor.clearMorph();
+                });
+    m.addSubMenu("Patch Morph", mor);
+
+    auto mot = juce::PopupMenu();
+    auto &recorder = processor.motionRecorder;
+    auto recItem = [w = juce::Component::SafePointer(this)](MotionRecorder::Mode md)
+    {
+        return [w, md]()
+        {
+            if (w)
+                w->processor.motionRecorder.requestMode(md);
+        };
+    };
+    auto rm = recorder.getMode();
+    mot.addItem("Record On Transport Start", true,
+                rm == MotionRecorder::ARMED || rm == MotionRecorder::RECORDING,
+                recItem(MotionRecorder::ARMED));
+    mot.addItem("Play Loop With Transport", recorder.hasLoop(), rm == MotionRecorder::PLAYING,
+                recItem(MotionRecorder::PLAYING));
+    mot.addItem("Stop", rm != MotionRecorder::STOPPED, false, recItem(MotionRecorder::STOPPED));
+    m.addSubMenu("Motion Recorder", mot);
+
+    static constexpr std::array<const char *, Modulator::numShapes> shapeNames{
+        "Off", "Sine", "Triangle", "Saw", "Square", "Sample & Hold", "Steps"};
+    static constexpr std::array<std::pair<const char *, float>, 9> cycleNames{
+        {{"1/16", 0.25f},
+         {"1/8", 0.5f},
+         {"1/4", 1.f},
+         {"1/2", 2.f},
+         {"1 Bar", 4.f},
+         {"2 Bars", 8.f},
+         {"4 Bars", 16.f},
+         {"8 Bars", 32.f},
+         {"16 Bars", 64.f}}};
+
+    auto mods = juce::PopupMenu();
+    for (int i = 0; i < ModulatorBank::maxModulators; ++i)
+    {
+        auto &mod = processor.modulators.mods[i];
+        auto modItem = [w = juce::Component::SafePointer(this), i](auto f)
+        {
+            return [w, i, f]()
+            {
+                if (w)
+                    f(w->processor.modulators.mods[i]);
+            };
+        };
+
+        auto shp = juce::PopupMenu();
+        for (int sh = 0; sh < Modulator::numShapes; ++sh)
+            shp.addItem(shapeNames[sh], true, mod.shape == sh,
+                        modItem([sh](auto &md) { md.shape = sh; }));
+
+        auto tgt = juce::PopupMenu();
+        for (auto p : processor.params)
+        {
+            tgt.addItem(p->desc.name, true, mod.target == p->control,
+                        modItem([c = (int)p->control, ed = processor.editDevice.load()](auto &md)
+                                {
+                                    md.device = ed;
+                                    md.target = c;
+                                }));
+        }
+
+        auto cyc = juce::PopupMenu();
+        for (auto &cn : cycleNames)
+        {
+            auto b = cn.second;
+            cyc.addItem(cn.first, true, mod.cycleBeats == b,
+                        modItem([b](auto &md) { md.cycleBeats = b; }));
+        }
+
+        auto dep = juce::PopupMenu();
+        for (auto d : {4, 8, 16, 32, 64, 127, -8, -16, -32, -64})
+            dep.addItem(std::to_string(d), true, (int)mod.depth.load() == d,
+                        modItem([d](auto &md) { md.depth = (float)d; }));
+
+        auto sub = juce::PopupMenu();
+        sub.addSubMenu("Shape", shp);
+        sub.addSubMenu("Target", tgt);
+        sub.addSubMenu("Cycle", cyc);
+        sub.addSubMenu("Depth", dep);
+        sub.addItem("Randomize Steps", true, false,
+                    modItem(
+                        [](auto &md)
+                        {
+                            auto &rng = juce::Random::getSystemRandom();
+                            for (auto &st : md.steps)
+                                st = rng.nextFloat() * 2.f - 1.f;
+                        }));
+
+        auto lab = "Modulator " + std::to_string(i + 1);
+        if (mod.isActive())
+            lab += std::string(" (") + shapeNames[mod.shape] + " > " +
+                   processor.params[mod.target]->desc.name + ")";
+        mods.addSubMenu(lab, sub);
+    }
+    m.addSubMenu("Modulators", mods);
+
     m.addSeparator();
 
     m.addItem("About...",
@@ -565,63 +769,93 @@ void ElfinMainPanel::showElfinMainMenu()
     m.addItem(vi, false, false, []() {});
     m.addItem(sst::plugininfra::VersionInformation::git_commit_hash, false, false, []() {});
     m.addColumnBreak();
-    m.addSectionHeader("Factory Presets");
+    for (juce::PopupMenu::MenuItemIterator it(presetMenus.columns); it.next();)
+        m.addItem(it.getItem());
 
-    auto mk = [w = juce::Component::SafePointer(this)](const int &c)
-    {
-        return [q = w, idx = c]()
-        {
-            if (!q)
-                return;
-            q->presetDataBinding->setValueFromGUI(idx);
-            q->repaint();
-        };
-    };
+    auto bd = presetButton->getBounds();
+    auto where = bd.getBottomLeft();
+    auto rec =
+        juce::Rectangle<int>().withWidth(1).withHeight(1).withPosition(localPointToGlobal(where));
+    m.showMenuAsync(juce::PopupMenu::Options().withParentComponent(this).withTargetScreenArea(rec),
+                    [w = juce::Component::SafePointer(this)](int result)
+                    {
+                        if (!w || result < presetMenuIdBase)
+                            return;
+                        w->presetDataBinding->setValueFromGUI(result - presetMenuIdBase);
+                        w->repaint();
+                    });
+}
+
+std::string ElfinMainPanel::catalogueLabel(int32_t ci) const
+{
+    if (ci >= (int32_t)PresetManager::numFactoryPatches())
+        return presetDataBinding->getNameFor(ci + 1);
+    auto &fp = PresetManager::factoryPatch(ci);
+    return std::string(factory_bank::nameOf(factory_bank::categoryOf(fp))) + "/" +
+           factory_bank::nameOf(fp);
+}
+
+void ElfinMainPanel::updatePresetMenus()
+{
+    auto &pm = *presetManager;
+    auto &c = presetMenus;
+    if (c.valid && c.generation == pm.catalogueGeneration)
+        return;
 
-    for (auto &[k, v] : presetManager->factoryPatchTree)
+    c.columns = juce::PopupMenu();
+    c.columns.addSectionHeader("Factory Presets");
+    for (size_t ci = 0; ci < factory_bank::nCategories; ++ci)
     {
+        auto &cat = factory_bank::categories[ci];
         auto sub = juce::PopupMenu();
-        for (auto &c : v)
-        {
-            auto lab = c.first;
-            auto ps = lab.find(".elfin");
-            if (ps != std::string::npos)
-                lab = lab.substr(0, ps);
-            sub.addItem(lab, mk(c.second));
-        }
-        m.addSubMenu(k, sub);
+        for (int i = cat.first; i < cat.first + cat.count; ++i)
+            sub.addItem(presetMenuIdBase + 1 + i,
+                        juce::String::fromUTF8(factory_bank::nameOf(factory_bank::patches[i])));
+        c.columns.addSubMenu(juce::String::fromUTF8(factory_bank::nameOf(cat)), sub);
     }
-    if (!presetManager->userPatches.empty())
+
+    if (!pm.userPatches.empty())
     {
-        m.addColumnBreak();
-        m.addSectionHeader("User Presets");
+        c.columns.addColumnBreak();
+        c.columns.addSectionHeader("User Presets");
     }
-
-    for (auto &[k, v] : presetManager->userPatchTree)
+    for (auto &[k, v] : pm.userPatchTree)
     {
         if (k.empty())
         {
-            for (auto &c : v)
-            {
-                m.addItem(c.first.replace_extension().u8string(), mk(c.second));
-            }
+            for (auto &e : v)
+                c.columns.addItem(presetMenuIdBase + e.second,
+                                  fs::path(e.first).replace_extension().u8string());
         }
         else
         {
             auto sub = juce::PopupMenu();
-            for (auto &c : v)
-            {
-                sub.addItem(c.first.filename().replace_extension().u8string(), mk(c.second));
-            }
-            m.addSubMenu(k.u8string(), sub);
+            for (auto &e : v)
+                sub.addItem(presetMenuIdBase + e.second,
+                            e.first.filename().replace_extension().u8string());
+            c.columns.addSubMenu(k.u8string(), sub);
         }
     }
 
-    auto bd = presetButton->getBounds();
-    auto where = bd.getBottomLeft();
-    auto rec =
-        juce::Rectangle<int>().withWidth(1).withHeight(1).withPosition(localPointToGlobal(where));
-    m.showMenuAsync(juce::PopupMenu::Options().withParentComponent(this).withTargetScreenArea(rec));
+    static constexpr size_t maxDuplicateGroups{100};
+    auto groups = pm.similarity().duplicateGroups();
+    c.duplicates = juce::PopupMenu();
+    for (size_t g = 0; g < std::min(groups.size(), maxDuplicateGroups); ++g)
+    {
+        auto gm = juce::PopupMenu();
+        for (auto ci : groups[g])
+            gm.addItem(presetMenuIdBase + 1 + ci, catalogueLabel(ci));
+        c.duplicates.addSubMenu(
+            catalogueLabel(groups[g][0]) + " (" + std::to_string(groups[g].size()) + ")", gm);
+    }
+    if (groups.size() > maxDuplicateGroups)
+        c.duplicates.addItem("and " + std::to_string(groups.size() - maxDuplicateGroups) +
+                                 " more",
+                             false, false, []() {});
+    c.hasDuplicates = !groups.empty();
+
+    c.generation = pm.catalogueGeneration;
+    c.valid = true;
 }
 
 void ElfinMainPanel::diceMenu()
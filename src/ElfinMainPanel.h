@@ -96,8 +96,28 @@ struct ElfinMainPanel : sst::jucegui::components::WindowPanel, juce::FileDragAnd
     fs::path userPath;
     std::unique_ptr<PresetManager> presetManager;
     std::unique_ptr<PresetDataBinding> presetDataBinding;
+    // Point the preset button at the preset the session says was loaded
+    void showSessionPreset();
     std::unique_ptr<PresetButton> presetButton;
 
+    /*
+     * The preset columns and duplicate list of the main menu only change with the
+     * catalogue, so they are built the first time the menu opens after it changes
+     * and reused. Their items carry presetMenuIdBase + the preset index as an id
+     * rather than an action each, which makes them cheap to copy in to the menu.
+     */
+    struct PresetMenus
+    {
+        bool valid{false};
+        uint64_t generation{0};
+        juce::PopupMenu columns, duplicates;
+        bool hasDuplicates{false};
+    } presetMenus;
+    static constexpr int presetMenuIdBase{1 << 20};
+    void updatePresetMenus();
+    // "Category/Name" for factory patches and the relative path for user ones
+    std::string catalogueLabel(int32_t catalogueIndex) const;
+
     std::unique_ptr<ElfinAbout> aboutScreen;
 
     bool isInterestedInFileDrag(const juce::StringArray &files) override;
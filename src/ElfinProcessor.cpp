@@ -14,6 +14,7 @@
 
 #include "ElfinProcessor.h"
 #include "ElfinEditor.h"
+#include "PatchCodec.h"
 
 #if LINUX
 // getCurrentPosition is deprecated in J7
@@ -26,32 +27,47 @@ namespace baconpaul::elfin_controller
 ElfinControllerAudioProcessor::ElfinControllerAudioProcessor()
     : AudioProcessor(BusesProperties().withOutput("Output", juce::AudioChannelSet::stereo(), true))
 {
-    setupConfiguration();
-
     std::fill(params.begin(), params.end(), nullptr);
-    for (const auto &[id, cc] : elfinConfig)
+
+    for (const auto &cc : elfinConfig)
     {
+        auto id = cc.control;
         auto def = float_param_t::getFloatForCC(cc.midiCCDefault);
-        params[id] = new float_param_t(id, cc.streaming_name, cc.name, def);
+        params[id] = new float_param_t(&devices[0].store, id, cc.streaming_name, cc.name, def);
         params[id]->addListener(this);
-        paramsByCC[cc.midiCC] = params[id];
+        addParameter(params[id]);
+    }
 
-        // In the standalone, force a send on startup
-        if (wrapperType == juce::AudioProcessor::WrapperType::wrapperType_Standalone)
-        {
-            params[id]->invalid = true;
-        }
+    // This goes after the elfin params so their indices match ElfinControl
+    morphParam = new juce::AudioParameterFloat({"morph", 1}, "Patch Morph",
+                                               juce::NormalisableRange<float>(0.0, 1.0), 0.f);
+    addParameter(morphParam);
 
-        addParameter(params[id]);
+    // The CLAP wrapper ids each param by the hash of its JUCE param id
+    for (auto p : getParameters())
+    {
+        if (auto pid = dynamic_cast<juce::AudioProcessorParameterWithID *>(p))
+            paramsByClapID[(clap_id)pid->paramID.hashCode()] = p;
     }
 
+    // In the standalone, force a send on startup
     if (wrapperType == juce::AudioProcessor::WrapperType::wrapperType_Standalone)
     {
+        devices[0].store.markAllDirty();
         sendAllNotesOff = true;
     }
+
+    hardwareGestureTimer = std::make_unique<HardwareGestureTimer>(*this);
+    paramSettleTimer = std::make_unique<ParamSettleTimer>(*this);
+    paramSettleTimer->startTimer(paramSettleMS / 2);
 }
 
-ElfinControllerAudioProcessor::~ElfinControllerAudioProcessor() {}
+ElfinControllerAudioProcessor::~ElfinControllerAudioProcessor()
+{
+    hardwareGestureTimer->stopTimer();
+    paramSettleTimer->stopTimer();
+    cancelPendingUpdate();
+}
 
 //==============================================================================
 const juce::String ElfinControllerAudioProcessor::getName() const { return JucePlugin_Name; }
@@ -68,7 +84,7 @@ double ElfinControllerAudioProcessor::getTailLengthSeconds() const { return 0.0;
 void ElfinControllerAudioProcessor::prepareToPlay(double sr, int samplesPerBlock)
 {
     isPlaying = true;
-    sampleGap = std::ceil(sr / 48000 * 4);
+    setEngineSampleRate(sr);
 }
 
 void ElfinControllerAudioProcessor::releaseResources() { isPlaying = false; }
@@ -76,43 +92,43 @@ void ElfinControllerAudioProcessor::releaseResources() { isPlaying = false; }
 void ElfinControllerAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
                                                  juce::MidiBuffer &midiMessages)
 {
-    int midiTimeForParams{0};
-    int numSamples = buffer.getNumSamples();
-
     buffer.clear();
 
-    bool anoOn{true}, anoDone{false};
-
-    if (sendAllNotesOff.compare_exchange_strong(anoOn, anoDone))
+    BlockInfo bi;
+    bi.numSamples = buffer.getNumSamples();
+    bi.sampleRate = getSampleRate();
+    bi.morph = morphParam->get();
+    if (needsTransport())
     {
-        midiTimeForParams = std::min(sampleGap, numSamples - 1);
-        midiMessages.addEvent(juce::MidiMessage::controllerEvent(1, 123, 0), 0);
+        juce::AudioPlayHead::CurrentPositionInfo cpi;
+        auto ph = getPlayHead();
+        if (ph && ph->getCurrentPosition(cpi))
+        {
+            bi.transportPlaying = cpi.isPlaying;
+            bi.ppq = cpi.ppqPosition;
+            bi.bpm = cpi.bpm;
+        }
     }
 
-    int ct{0};
-
-    for (auto &p : params)
+    beginEngineBlock(bi);
+    for (const auto meta : midiMessages)
     {
-        bool inOn{true}, onDone{false};
+        receiveMidi(meta.samplePosition, meta.data, meta.numBytes);
+    }
 
-        if (p && p->invalid.compare_exchange_strong(inOn, onDone))
+    struct BufferSink : MidiSink
+    {
+        juce::MidiBuffer &buffer;
+        BufferSink(juce::MidiBuffer &b) : buffer(b) {}
+        void addEvent(const uint8_t *data, int size, int sample) override
         {
-            midiMessages.addEvent(juce::MidiMessage::controllerEvent(1, p->desc.midiCC, p->getCC()),
-                                  midiTimeForParams);
-
-            if (ct == maxMessagesPerSample)
-            {
-                ct = 0;
-                midiTimeForParams += midiGapMultiplier * sampleGap;
-            }
-
-            ct++;
-
-            if (midiTimeForParams >= numSamples)
-            {
-                break;
-            }
+            buffer.addEvent(data, size, sample);
         }
+    } sink(midiMessages);
+
+    if (finishEngineBlock(bi, sink))
+    {
+        triggerAsyncUpdate();
     }
 }
 
@@ -131,147 +147,655 @@ juce::AudioProcessorEditor *ElfinControllerAudioProcessor::createEditor()
 void ElfinControllerAudioProcessor::parameterValueChanged(int parameterIndex, float newValue)
 {
     refreshUI = true;
+
+    if (parameterIndex >= 0 && parameterIndex < nElfinParams)
+    {
+        paramLastMoveMS[parameterIndex].store(juce::Time::getMillisecondCounter(),
+                                              std::memory_order_relaxed);
+        unsettledParams.fetch_or(1ULL << parameterIndex, std::memory_order_relaxed);
+    }
 }
 
-//==============================================================================
-void ElfinControllerAudioProcessor::getStateInformation(juce::MemoryBlock &destData)
+void ElfinControllerAudioProcessor::settleParam(int idx)
 {
-    auto s = toXML();
-    destData.append(s.c_str(), s.length() + 1);
+    // Only replace the CC hysteresis kept. If morph, playback or the device has put
+    // a newer value in the store since, that one stands.
+    auto p = params[idx];
+    auto kept = p->lastWrittenCC.load(std::memory_order_relaxed);
+    if (kept < 0)
+        return;
+    auto exact = p->getCCForFloat(p->get());
+    if (p->store.load()->replaceCC(idx, (int8_t)kept, (int8_t)exact))
+        p->lastWrittenCC.store(exact, std::memory_order_relaxed);
 }
 
-void ElfinControllerAudioProcessor::setStateInformation(const void *data, int sizeInBytes)
+void ElfinControllerAudioProcessor::settleIdleParams()
 {
-    auto q = std::string((const char *)data, (size_t)sizeInBytes);
-    if (!q.empty())
+    auto now = juce::Time::getMillisecondCounter();
+    auto walk = unsettledParams.load(std::memory_order_relaxed);
+    while (walk)
     {
-        fromXML(q);
+        auto idx = lowestSetBit(walk);
+        walk &= walk - 1;
+        if (now - paramLastMoveMS[idx].load(std::memory_order_relaxed) < paramSettleMS)
+            continue;
+        unsettledParams.fetch_and(~(1ULL << idx), std::memory_order_relaxed);
+        settleParam(idx);
     }
 }
 
-std::string ElfinControllerAudioProcessor::toXML() const
+void ElfinControllerAudioProcessor::handleAsyncUpdate()
 {
-    auto doc = juce::XmlElement("elfin");
-    doc.setAttribute("version", 1);
-    for (auto &p : params)
+    if (syncParamsFromStore.exchange(false))
+    {
+        // The store is already right so this moves the params and host without a send
+        for (auto p : params)
+        {
+            if (p->getCCForFloat(p->get()) != p->getCC())
+                p->setValueFromStoreNotifyingHost();
+        }
+    }
+
+    std::array<HardwareCCMsg, 64> msgs;
+    std::array<bool, nElfinParams> hardwareMoved{};
+    auto now = juce::Time::getMillisecondCounter();
+    bool anyOpen{false};
+    size_t n;
+    while ((n = fromHardware.pop_n(msgs.data(), msgs.size())) > 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto &msg = msgs[i];
+            if (msg.device != editDevice)
+            {
+                // Not bound to the host params; the store already has the value
+                refreshUI = true;
+                continue;
+            }
+            auto p = params[msg.param];
+            if (!hardwareGestureOpen[msg.param])
+            {
+                p->beginChangeGesture();
+                hardwareGestureOpen[msg.param] = true;
+            }
+            hardwareGestureLastMS[msg.param] = now;
+            hardwareMoved[msg.param] = true;
+            anyOpen = true;
+        }
+    }
+
+    // A sweep on the device queues every step, but the store has the latest. Give the
+    // host that once per param and leave the store alone so nothing goes back out.
+    for (int i = 0; i < nElfinParams; ++i)
     {
-        auto parX = new juce::XmlElement("param");
-        parX->setAttribute("id", p->desc.streaming_name);
-        parX->setAttribute("cc", p->desc.midiCC);
-        parX->setAttribute("ccval", p->getCC());
+        if (!hardwareMoved[i])
+            continue;
+        params[i]->setValueFromStoreNotifyingHost();
+    }
 
-        doc.addChildElement(parX);
+    if (fromHardware.getOverflowCount() != reportedHardwareOverflows)
+    {
+        reportedHardwareOverflows = fromHardware.getOverflowCount();
+        ELFLOG("Dropped hardware CC updates : " << reportedHardwareOverflows);
     }
 
-    return doc.toString().toStdString();
+    if (anyOpen && !hardwareGestureTimer->isTimerRunning())
+    {
+        hardwareGestureTimer->startTimer(hardwareGestureTimeoutMS / 2);
+    }
 }
-bool ElfinControllerAudioProcessor::fromXML(const std::string &s)
+
+void ElfinControllerAudioProcessor::closeIdleHardwareGestures()
 {
-    sendAllNotesOff = true;
-    auto doc = juce::XmlDocument(s);
-    if (auto mainElement = doc.getDocumentElement())
+    auto now = juce::Time::getMillisecondCounter();
+    bool anyOpen{false};
+    for (int i = 0; i < nElfinParams; ++i)
     {
-        if (mainElement->getTagName() != "elfin")
+        if (!hardwareGestureOpen[i])
+            continue;
+
+        if (now - hardwareGestureLastMS[i] >= hardwareGestureTimeoutMS)
         {
-            ELFLOG("Not Elfin!");
-            return false;
+            params[i]->endChangeGesture();
+            hardwareGestureOpen[i] = false;
         }
-        if (mainElement->getIntAttribute("version", -1) != 1)
+        else
         {
-            ELFLOG("Not version 1!");
-            return false;
+            anyOpen = true;
         }
+    }
+
+    if (!anyOpen)
+    {
+        hardwareGestureTimer->stopTimer();
+    }
+}
+
+bool ElfinControllerAudioProcessor::supportsDirectEvent(uint16_t space_id, uint16_t type)
+{
+    return space_id == CLAP_CORE_EVENT_SPACE_ID && type == CLAP_EVENT_PARAM_VALUE;
+}
+
+void ElfinControllerAudioProcessor::handleDirectEvent(const clap_event_header_t *event,
+                                                      int sampleOffset)
+{
+    if (event->space_id != CLAP_CORE_EVENT_SPACE_ID || event->type != CLAP_EVENT_PARAM_VALUE)
+        return;
+
+    // Apply the value just as the wrapper would, but remember where in the block it goes.
+    // The cookie belongs to the wrapper and hosts may send it null, so go by param_id.
+    auto pevt = reinterpret_cast<const clap_event_param_value *>(event);
+    auto pit = paramsByClapID.find(pevt->param_id);
+    if (pit == paramsByClapID.end())
+        return;
+    auto jp = pit->second;
+
+    auto nf = (float)pevt->value;
+    if (jp->getValue() != nf)
+    {
+        jp->setValue(nf);
+        jp->sendValueChangedMessageToListeners(nf);
+    }
+
+    auto idx = jp->getParameterIndex();
+    if (idx >= 0 && idx < nElfinParams)
+        devices[editDevice].store.setTimed(idx, sampleOffset);
+}
+
+void ElfinControllerAudioProcessor::parameterGestureChanged(int parameterIndex, bool isStarting)
+{
+    if (parameterIndex >= 0 && parameterIndex < nElfinParams)
+    {
+        // The final value of a gesture goes out exact, with the rate hold lifted
+        if (!isStarting)
+            settleParam(parameterIndex);
+        devices[editDevice].scheduler.setTouched(parameterIndex, isStarting);
+    }
+}
+
+//==============================================================================
+void ElfinControllerAudioProcessor::getStateInformation(juce::MemoryBlock &destData)
+{
+    std::vector<uint8_t> s;
+    s.reserve(1024);
+    toBinaryState(s);
+    destData.append(s.data(), s.size());
+}
+
+void ElfinControllerAudioProcessor::setStateInformation(const void *data, int sizeInBytes)
+{
+    if (sizeInBytes <= 0)
+        return;
+
+    // The top level params are always device 0
+    setEditDevice(0);
+    if (binstate::isBinaryState(data, (size_t)sizeInBytes))
+    {
+        fromBinaryState(data, (size_t)sizeInBytes);
+        return;
+    }
+
+    // Sessions saved before the binary state have XML
+    auto q = std::string((const char *)data, (size_t)sizeInBytes);
+    fromXML(q);
+    devicesFromXML(q);
+}
+
+void ElfinControllerAudioProcessor::toBinaryState(std::vector<uint8_t> &into) const
+{
+    binstate::Writer w(into);
+
+    auto ccs = emptyPatchCCs();
+    auto fill = [&ccs](auto &&get)
+    {
+        for (int i = 0; i < nElfinParams; ++i)
+            ccs[i] = get(i);
+    };
+
+    fill([this](int i) { return devices[0].store.getCC(i); });
+    w.beginSection(binstate::PARAMS, 0);
+    w.addParams(ccs);
+
+    w.beginSection(binstate::DEVICES, 0);
+    w.addU8((uint8_t)numDevices.load());
+    w.addU8((uint8_t)editDevice.load());
+    for (int d = 0; d < numDevices; ++d)
+        w.addU8((uint8_t)devices[d].channel.load());
+
+    for (int d = 1; d < numDevices; ++d)
+    {
+        fill([this, d](int i) { return devices[d].store.getCC(i); });
+        w.beginSection(binstate::PARAMS, d);
+        w.addParams(ccs);
+    }
+
+    for (auto which : {PatchMorph::A, PatchMorph::B})
+    {
+        if (!morph.hasCaptured(which))
+            continue;
+        fill([this, which](int i) { return morph.getSlotCC(which, i); });
+        w.beginSection(binstate::MORPH, which);
+        w.addParams(ccs);
+    }
+
+    for (int i = 0; i < ModulatorBank::maxModulators; ++i)
+    {
+        auto &m = modulators.mods[i];
+        if (m.shape == Modulator::OFF)
+            continue;
+        w.beginSection(binstate::MODULATOR, i);
+        w.addU8((uint8_t)m.shape.load());
+        auto t = m.target.load();
+        w.addU32(t >= 0 && t < nElfinParams ? binstate::detail::paramIdHashes[t] : 0);
+        w.addU8((uint8_t)m.device.load());
+        w.addFloat(m.cycleBeats);
+        w.addFloat(m.depth);
+        auto ns = std::clamp(m.numSteps.load(), 1, Modulator::maxSteps);
+        w.addU8((uint8_t)ns);
+        for (int s = 0; s < ns; ++s)
+            w.addFloat(m.steps[s]);
+    }
+
+    if (!presetName.empty())
+    {
+        w.beginSection(binstate::PRESET, 0);
+        w.addString(presetName);
+    }
 
-        auto *child = mainElement->getFirstChildElement();
+    w.finish();
+}
 
-        std::map<std::string, int> valueMap;
-        while (child)
+bool ElfinControllerAudioProcessor::fromBinaryState(const void *data, size_t size)
+{
+    binstate::Reader r(data, size);
+    if (!r.isValid())
+        return false;
+
+    morph.clear();
+    for (auto &m : modulators.mods)
+        m.shape = Modulator::OFF;
+    presetName.clear();
+
+    bool sawDevices{false};
+    int edit{0};
+    binstate::Kind kind;
+    int index;
+    while (r.nextSection(kind, index))
+    {
+        auto ccs = emptyPatchCCs();
+        switch (kind)
         {
-            if (child->getTagName() == "param")
+        case binstate::PARAMS:
+        {
+            r.getParams(ccs);
+            if (!r.sectionOK())
+                break;
+            if (index == 0)
+            {
+                applyPatchCCs(ccs);
+            }
+            else if (index < numDevices)
             {
-                auto sn = child->getStringAttribute("id");
-                auto sc = child->getIntAttribute("ccval");
-                valueMap[sn.toStdString()] = sc;
+                for (int i = 0; i < nElfinParams; ++i)
+                    if (ccs[i] >= 0)
+                        devices[index].store.setCC(i, (int8_t)ccs[i]);
+                devices[index].sendAllNotesOff = true;
             }
-            child = child->getNextElement();
+            break;
         }
-        for (auto p : params)
+        case binstate::DEVICES:
+        {
+            auto n = r.getU8();
+            edit = r.getU8();
+            if (!r.sectionOK())
+                break;
+            sawDevices = true;
+            setNumDevices(n);
+            for (int d = 0; d < n && d < numDevices; ++d)
+            {
+                auto ch = r.getU8();
+                if (r.sectionOK())
+                    setDeviceChannel(d, ch);
+            }
+            break;
+        }
+        case binstate::MORPH:
+        {
+            r.getParams(ccs);
+            if (!r.sectionOK() || index > PatchMorph::B)
+                break;
+            for (int i = 0; i < nElfinParams; ++i)
+                if (ccs[i] >= 0)
+                    morph.setSlotCC((PatchMorph::Slot)index, i, (int8_t)ccs[i]);
+            break;
+        }
+        case binstate::MODULATOR:
+        {
+            if (index >= ModulatorBank::maxModulators)
+                break;
+            auto &m = modulators.mods[index];
+            auto shape = r.getU8();
+            auto target = binstate::controlForParamIdHash(r.getU32(), -1);
+            auto dev = r.getU8();
+            auto cycle = r.getFloat();
+            auto depth = r.getFloat();
+            auto ns = std::clamp<int>(r.getU8(), 1, Modulator::maxSteps);
+            std::array<float, Modulator::maxSteps> steps{};
+            for (int s = 0; s < ns; ++s)
+                steps[s] = std::clamp(r.getFloat(), -1.f, 1.f);
+            if (!r.sectionOK())
+                break;
+            m.target = target;
+            m.device = std::clamp<int>(dev, 0, ElfinDevice::maxDevices - 1);
+            m.cycleBeats = cycle;
+            m.depth = depth;
+            m.numSteps = ns;
+            for (int s = 0; s < ns; ++s)
+                m.steps[s] = steps[s];
+            m.shape = std::clamp<int>(shape, 0, Modulator::numShapes - 1);
+            break;
+        }
+        case binstate::PRESET:
         {
-            auto pos = valueMap.find(p->desc.streaming_name);
-            if (pos != valueMap.end())
-                p->setValueNotifyingHost(p->getFloatForCC(pos->second));
+            auto name = r.getString();
+            if (r.sectionOK())
+                presetName = name;
+            break;
+        }
+        default:
+            break;
         }
-        applyPostPatchChangeConstraints();
     }
-    else
+    morphRebase = true;
+
+    if (!sawDevices)
     {
-        ELFLOG(doc.getLastParseError());
+        setNumDevices(1);
+        setDeviceChannel(0, 1);
     }
+    setEditDevice(edit);
+    presetNameRestored = true;
     return true;
 }
 
-bool ElfinControllerAudioProcessor::fromSYX(const std::vector<uint8_t> &d)
+std::string ElfinControllerAudioProcessor::toXML(bool includeDevices) const
 {
-    if (d.size() != 108)
+    // State stores device 0 at the top level whoever is being edited
+    const auto &topStore = includeDevices ? devices[0].store : devices[editDevice].store;
+    auto ccs = emptyPatchCCs();
+    for (auto &p : params)
+        ccs[p->control] = topStore.getCC(p->control);
+
+    std::string res;
+    encodeElfin(ccs, res, !includeDevices);
+
+    if (includeDevices)
     {
-        ELFLOG("Mis-sized sysex data");
+        // The rest of the state is rare and nested so it's fine to build it as a DOM
+        auto doc = juce::XmlElement("elfin");
+        auto devX = new juce::XmlElement("devices");
+        devX->setAttribute("count", numDevices.load());
+        devX->setAttribute("edit", editDevice.load());
+        for (int d = 0; d < numDevices; ++d)
+        {
+            auto dX = new juce::XmlElement("device");
+            dX->setAttribute("index", d);
+            dX->setAttribute("channel", devices[d].channel.load());
+            if (d > 0)
+            {
+                for (auto &p : params)
+                {
+                    auto parX = new juce::XmlElement("param");
+                    parX->setAttribute("id", p->desc.streaming_name);
+                    parX->setAttribute("ccval", devices[d].store.getCC(p->control));
+                    dX->addChildElement(parX);
+                }
+            }
+            devX->addChildElement(dX);
+        }
+        doc.addChildElement(devX);
+
+        for (auto which : {PatchMorph::A, PatchMorph::B})
+        {
+            if (!morph.hasCaptured(which))
+                continue;
+            auto mX = new juce::XmlElement("morph");
+            mX->setAttribute("slot", which == PatchMorph::A ? "a" : "b");
+            for (auto &p : params)
+            {
+                auto parX = new juce::XmlElement("param");
+                parX->setAttribute("id", p->desc.streaming_name);
+                parX->setAttribute("ccval", morph.getSlotCC(which, p->control));
+                mX->addChildElement(parX);
+            }
+            doc.addChildElement(mX);
+        }
+
+        for (int i = 0; i < ModulatorBank::maxModulators; ++i)
+        {
+            auto &m = modulators.mods[i];
+            if (m.shape == Modulator::OFF)
+                continue;
+            auto mX = new juce::XmlElement("modulator");
+            mX->setAttribute("index", i);
+            mX->setAttribute("shape", m.shape.load());
+            if (m.target >= 0 && m.target < nElfinParams)
+                mX->setAttribute("target", params[m.target]->desc.streaming_name);
+            mX->setAttribute("device", m.device.load());
+            mX->setAttribute("cycle", m.cycleBeats.load());
+            mX->setAttribute("depth", m.depth.load());
+            juce::StringArray st;
+            for (int s = 0; s < m.numSteps; ++s)
+                st.add(juce::String(m.steps[s].load()));
+            mX->setAttribute("steps", st.joinIntoString(" "));
+            doc.addChildElement(mX);
+        }
+
+        auto fmt = juce::XmlElement::TextFormat().withoutHeader();
+        for (auto *c : doc.getChildIterator())
+            res += c->toString(fmt).toStdString();
+        closeElfin(res);
+    }
+
+    return res;
+}
+
+bool ElfinControllerAudioProcessor::fromXML(const std::string &s)
+{
+    auto ccs = emptyPatchCCs();
+    if (!decodeElfin(s, ccs))
         return false;
+
+    applyPatchCCs(ccs);
+    return true;
+}
+
+PatchCCs ElfinControllerAudioProcessor::currentPatchCCs() const
+{
+    auto res = emptyPatchCCs();
+    auto &store = devices[editDevice].store;
+    for (int i = 0; i < nElfinParams; ++i)
+        res[i] = store.getCC(i);
+    return res;
+}
+
+void ElfinControllerAudioProcessor::applyPatchCCs(const PatchCCs &ccs, bool allNotesOff)
+{
+    auto staged = currentPatchCCs();
+    for (int i = 0; i < nElfinParams; ++i)
+    {
+        if (ccs[i] >= 0)
+            staged[i] = ccs[i];
     }
-    sendAllNotesOff = true;
-    for (auto i = 0; i < d.size(); i += 3)
+    applyPatchConstraints(staged);
+
+    // All notes off goes first so the audio thread sees it with the batch
+    auto &dev = devices[editDevice];
+    if (allNotesOff)
+        dev.sendAllNotesOff = true;
+    uint64_t batch{0};
+    for (int i = 0; i < nElfinParams; ++i)
+        dev.store.setCCInBatch(i, (int8_t)staged[i], batch);
+    dev.store.publishBatch(batch);
+
+    // The store already has the values, so this moves the params and tells the host
+    // about the ones which changed without flagging anything again
+    while (batch)
     {
-        if (d[i] != 0xb0)
-        {
-            ELFLOG("Non-control-byte at " << i);
-            return false;
-        }
-        int cc = d[i + 1];
-        int va = d[i + 2];
-        auto pit = paramsByCC.find(cc);
-        if (pit != paramsByCC.end())
+        auto idx = lowestSetBit(batch);
+        batch &= batch - 1;
+        params[idx]->setValueNotifyingHost(params[idx]->getFloatForCC(staged[idx]));
+    }
+    refreshUI = true;
+}
+
+void ElfinControllerAudioProcessor::devicesFromXML(const std::string &s)
+{
+    auto doc = juce::XmlDocument(s);
+    auto mainElement = doc.getDocumentElement();
+    if (!mainElement)
+        return;
+
+    morph.clear();
+    for (auto *mX : mainElement->getChildWithTagNameIterator("morph"))
+    {
+        auto which = mX->getStringAttribute("slot") == "b" ? PatchMorph::B : PatchMorph::A;
+        for (auto *parX : mX->getChildWithTagNameIterator("param"))
         {
-            pit->second->setValueNotifyingHost(pit->second->getFloatForCC(va));
+            auto c = controlForStreamingName(parX->getStringAttribute("id").toStdString());
+            if (c >= 0)
+                morph.setSlotCC(which, c, std::clamp(parX->getIntAttribute("ccval"), 0, 127));
         }
-        else
+    }
+    morphRebase = true;
+
+    for (auto &m : modulators.mods)
+        m.shape = Modulator::OFF;
+    for (auto *mX : mainElement->getChildWithTagNameIterator("modulator"))
+    {
+        auto i = mX->getIntAttribute("index", -1);
+        if (i < 0 || i >= ModulatorBank::maxModulators)
+            continue;
+        auto &m = modulators.mods[i];
+        m.target = controlForStreamingName(mX->getStringAttribute("target").toStdString());
+        m.device = std::clamp(mX->getIntAttribute("device"), 0, ElfinDevice::maxDevices - 1);
+        m.cycleBeats = (float)mX->getDoubleAttribute("cycle", 1.0);
+        m.depth = (float)mX->getDoubleAttribute("depth", 32.0);
+        juce::StringArray st;
+        st.addTokens(mX->getStringAttribute("steps"), " ", "");
+        st.removeEmptyStrings();
+        m.numSteps = std::clamp(st.size(), 1, Modulator::maxSteps);
+        for (int s = 0; s < st.size() && s < Modulator::maxSteps; ++s)
+            m.steps[s] = std::clamp(st[s].getFloatValue(), -1.f, 1.f);
+        m.shape = std::clamp(mX->getIntAttribute("shape"), 0, Modulator::numShapes - 1);
+    }
+
+    auto devX = mainElement->getChildByName("devices");
+    if (!devX)
+    {
+        setNumDevices(1);
+        setDeviceChannel(0, 1);
+        return;
+    }
+
+    setNumDevices(devX->getIntAttribute("count", 1));
+    for (auto *dX : devX->getChildWithTagNameIterator("device"))
+    {
+        auto d = dX->getIntAttribute("index", -1);
+        if (d < 0 || d >= numDevices)
+            continue;
+
+        setDeviceChannel(d, dX->getIntAttribute("channel", d + 1));
+        if (d == 0)
+            continue;
+
+        auto &store = devices[d].store;
+        for (auto *parX : dX->getChildWithTagNameIterator("param"))
         {
-            ELFLOG("Unable to map param " << cc << " val=" << va);
+            auto c = controlForStreamingName(parX->getStringAttribute("id").toStdString());
+            if (c >= 0)
+                store.setCC(c, std::clamp(parX->getIntAttribute("ccval"), 0, 127));
         }
+        devices[d].sendAllNotesOff = true;
     }
-    applyPostPatchChangeConstraints();
+    setEditDevice(devX->getIntAttribute("edit", 0));
+}
+
+void ElfinControllerAudioProcessor::captureMorph(PatchMorph::Slot which)
+{
+    morph.capture(which, devices[editDevice].store);
+    morphRebase = true;
+}
+
+void ElfinControllerAudioProcessor::clearMorph() { morph.clear(); }
+
+void ElfinControllerAudioProcessor::setNumDevices(int n)
+{
+    if (editDevice >= std::clamp(n, 1, ElfinDevice::maxDevices))
+        setEditDevice(0);
+    setDeviceCount(n);
+}
+
+void ElfinControllerAudioProcessor::setEditDevice(int d)
+{
+    if (d < 0 || d >= numDevices || d == editDevice)
+        return;
+
+    editDevice = d;
+    auto *store = &devices[d].store;
+    for (auto p : params)
+    {
+        // The store already has the values so rebinding the params sends nothing
+        p->store = store;
+        p->setValueFromStoreNotifyingHost();
+    }
+    refreshUI = true;
+}
+
+bool ElfinControllerAudioProcessor::fromSYX(const std::vector<uint8_t> &d)
+{
+    auto ccs = emptyPatchCCs();
+    if (!decodeSYX(d, ccs))
+        return false;
+
+    applyPatchCCs(ccs);
     return true;
 }
 
+void ElfinControllerAudioProcessor::initPatch()
+{
+    auto ccs = emptyPatchCCs();
+    for (auto &d : elfinConfig)
+        ccs[d.control] = (int16_t)d.midiCCDefault;
+    applyPatchCCs(ccs, false);
+}
+
 void ElfinControllerAudioProcessor::randomizePatch(bool justTweak)
 {
+    auto ccs = currentPatchCCs();
     if (justTweak)
     {
-        for (auto p : params)
+        for (auto &d : elfinConfig)
         {
             if (rand() % 10 > 7)
             {
-                auto ccv = p->getCC();
-                ccv += rand() % 20 - 10;
-                ccv = std::clamp(ccv, 0, 127);
-                p->setValueNotifyingHost(p->getFloatForCC(ccv));
+                auto ccv = std::clamp(ccs[d.control] + rand() % 20 - 10, 0, 127);
+                ccs[d.control] = (int16_t)d.snapToDiscrete(ccv);
             }
         }
     }
     else
     {
-        for (auto p : params)
+        for (auto &d : elfinConfig)
         {
-            p->setValueNotifyingHost(p->getFloatForCC(rand() % 128));
+            // Pick switch positions evenly rather than by how many CCs they span
+            if (d.hasDiscreteRanges())
+                ccs[d.control] = (int16_t)d.ccForDiscreteIndex(rand() % d.discreteRanges.size());
+            else
+                ccs[d.control] = (int16_t)(rand() % 128);
         }
     }
-    applyPostPatchChangeConstraints();
-}
-
-void ElfinControllerAudioProcessor::applyPostPatchChangeConstraints()
-{
-    if (params[POLY_UNI_MODE]->getCC() < 64)
-    {
-        params[KEY_ASSIGN_MODE]->setValueNotifyingHost(params[KEY_ASSIGN_MODE]->getFloatForCC(119));
-    }
+    applyPatchCCs(ccs, false);
 }
 
 } // namespace baconpaul::elfin_controller
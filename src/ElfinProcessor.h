@@ -15,56 +15,23 @@
 #define ELFIN_CONTROLLER_ELFINPROCESSOR_H
 
 #include "juce_audio_processors/juce_audio_processors.h"
+#include "clap-juce-extensions/clap-juce-extensions.h"
 #include "configuration.h"
+#include "ElfinEngine.h"
+#include "PatchCodec.h"
 #include <vector>
 #include <map>
 
 namespace baconpaul::elfin_controller
 {
-template <typename T, int Capacity = 4096> class LockFreeQueue
-{
-  public:
-    LockFreeQueue() : fifo(Capacity) {}
-
-    void push(const T &item)
-    {
-        int start1, size1, start2, size2;
-        fifo.prepareToWrite(1, start1, size1, start2, size2);
-
-        if (size1 > 0)
-        {
-            buffer[start1] = item;
-        }
-
-        fifo.finishedWrite(size1);
-    }
-
-    bool pop(T &item)
-    {
-        int start1, size1, start2, size2;
-        fifo.prepareToRead(1, start1, size1, start2, size2);
-
-        if (size1 > 0)
-        {
-            item = buffer[start1];
-        }
-
-        fifo.finishedRead(size1);
-
-        return size1 > 0;
-    }
-
-  private:
-    juce::AbstractFifo fifo;
-    std::array<T, Capacity> buffer;
-};
-
 //==============================================================================
 /**
  */
 class ElfinControllerAudioProcessor : public juce::AudioProcessor,
                                       public juce::AudioProcessorParameter::Listener,
-                                      public juce::AsyncUpdater
+                                      public juce::AsyncUpdater,
+                                      public clap_juce_extensions::clap_juce_audio_processor_capabilities,
+                                      public ElfinEngine
 {
   public:
     //==============================================================================
@@ -95,8 +62,15 @@ class ElfinControllerAudioProcessor : public juce::AudioProcessor,
     void setStateInformation(const void *data, int sizeInBytes) override;
 
     void parameterValueChanged(int parameterIndex, float newValue) override;
-    void parameterGestureChanged(int parameterIndex, bool isStarting) override {}
-    void handleAsyncUpdate() override {}
+    void parameterGestureChanged(int parameterIndex, bool isStarting) override;
+    void handleAsyncUpdate() override;
+
+    // CLAP hands us param events with their sample offset so CCs can land in time
+    bool supportsDirectEvent(uint16_t space_id, uint16_t type) override;
+    void handleDirectEvent(const clap_event_header_t *event, int sampleOffset) override;
+
+    // CLAP param ids to our params, matching the ids the wrapper gives the host
+    std::map<clap_id, juce::AudioProcessorParameter *> paramsByClapID;
 
     int getNumPrograms() override { return 1; }
     int getCurrentProgram() override { return 0; }
@@ -104,68 +78,136 @@ class ElfinControllerAudioProcessor : public juce::AudioProcessor,
     const juce::String getProgramName(int index) override { return "Init"; }
     void changeProgramName(int index, const juce::String &newName) override {}
 
-    struct ResetTypeMsg
+    /*
+     * The engine queues CCs from the hardware in fromHardware for us to push to the
+     * params and the host. Since the host can't record without a gesture, we open
+     * one on the first CC and close it after a quiet period.
+     */
+    uint64_t reportedHardwareOverflows{0};
+    static constexpr uint32_t hardwareGestureTimeoutMS{250};
+    std::array<bool, nElfinParams> hardwareGestureOpen{};
+    std::array<uint32_t, nElfinParams> hardwareGestureLastMS{};
+    void closeIdleHardwareGestures();
+
+    struct HardwareGestureTimer : juce::Timer
+    {
+        HardwareGestureTimer(ElfinControllerAudioProcessor &p) : processor(p) {}
+        void timerCallback() override { processor.closeIdleHardwareGestures(); }
+        ElfinControllerAudioProcessor &processor;
+    };
+    std::unique_ptr<HardwareGestureTimer> hardwareGestureTimer;
+
+    /*
+     * Host and UI values reach the store with hysteresis, which can leave the CC a
+     * step away from the exact value where a move stops. When a gesture ends, or a
+     * param has been still for paramSettleMS, we store the exact CC so it goes out,
+     * as long as the store still holds the CC hysteresis gave it.
+     */
+    static constexpr uint32_t paramSettleMS{150};
+    std::atomic<uint64_t> unsettledParams{0};
+    std::array<std::atomic<uint32_t>, nElfinParams> paramLastMoveMS{};
+    void settleParam(int idx);
+    void settleIdleParams();
+
+    struct ParamSettleTimer : juce::Timer
     {
-        int type; // -1 for type, otherwise param
-        int32_t toIndex;
-        float value;
+        ParamSettleTimer(ElfinControllerAudioProcessor &p) : processor(p) {}
+        void timerCallback() override { processor.settleIdleParams(); }
+        ElfinControllerAudioProcessor &processor;
     };
-    LockFreeQueue<ResetTypeMsg> resetType;
+    std::unique_ptr<ParamSettleTimer> paramSettleTimer;
 
     std::atomic<bool> refreshUI{false}, rebuildUI{false};
-    std::atomic<bool> sendAllNotesOff{false};
 
     //==============================================================================
+    // The engine holds the devices; these also move the host params with the edit device
+    void setNumDevices(int n);
+    void setEditDevice(int d);
+
     struct ElfinParam : juce::AudioParameterFloat
     {
+        std::atomic<ParamStore *> store;
         ElfinControl control;
-        ElfinDescription desc;
-        ElfinParam(ElfinControl c, juce::String sname, juce::String name, float def)
-            : control(c),
+        const ElfinDescription &desc;
+        ElfinParam(ParamStore *s, ElfinControl c, juce::String sname, juce::String name, float def)
+            : store(s), control(c), desc(elfinConfig[c]),
               juce::AudioParameterFloat({sname, 1}, name,
                                         juce::NormalisableRange<float>(0.0, 1.0, 0.001), def)
         {
-            desc = elfinConfig.at(control);
+            s->initCC(control, getCCForFloat(def));
         }
 
-        static float getFloatForCC(int cc) { return std::clamp(cc / 127.0, 0., 1.); }
-        int getCCForFloat(float f)
+        static float getFloatForCC(int cc) { return floatForCC(cc); }
+        int getCCForFloat(float f) { return ccForFloat(convertTo0to1(f)); }
+        int getCC() const { return store.load()->getCC(control); }
+        int getDiscreteIndex() const { return desc.discreteIndexFor(getCC()); }
+        void setDiscreteIndexNotifyingHost(int i)
         {
-            return std::clamp((int)std::round(convertTo0to1(f) * 127), 0, 127);
+            setValueNotifyingHost(getFloatForCC(desc.ccForDiscreteIndex(i)));
         }
-        int getCC() { return getCCForFloat(get()); }
-        std::atomic<bool> invalid{false};
+        int getCCForFloatWithHysteresis(float f)
+        {
+            return ccForFloatWithHysteresis(convertTo0to1(f), getCC(), desc.ccHysteresis);
+        }
+
+        // Move the param and the host to the value the store already holds. That
+        // quantizes to the stored CC, so valueChanged leaves the store alone and
+        // nothing goes back out.
+        void setValueFromStoreNotifyingHost() { setValueNotifyingHost(getFloatForCC(getCC())); }
+
+        // The CC valueChanged last asked the store for, which settling may replace
+        std::atomic<int> lastWrittenCC{-1};
 
       protected:
         void valueChanged(float newValue) override
         {
-            auto ccv = getCCForFloat(newValue);
-            if (ccv != lastCCValue)
-            {
-                invalid = true;
-            }
-            lastCCValue = ccv;
+            auto s = store.load();
+            auto cc = getCCForFloatWithHysteresis(newValue);
+            lastWrittenCC.store(cc, std::memory_order_relaxed);
+            if (cc == s->getCC(control))
+                return;
+            s->setCC(control, cc);
         }
-        int8_t lastCCValue{-1};
     };
     typedef ElfinParam float_param_t;
     std::array<float_param_t *, nElfinParams> params{};
-    std::map<int, float_param_t *> paramsByCC;
-    int sampleGap{0};
-    static constexpr int maxMessagesPerSample{3};
-    std::atomic<int> midiGapMultiplier{2};
+
+    juce::AudioParameterFloat *morphParam{nullptr};
+    void captureMorph(PatchMorph::Slot which);
+    void clearMorph();
 
     juce::AudioParameterBool *bypassParam{nullptr};
     juce::AudioProcessorParameter *getBypassParameter() const override { return bypassParam; }
 
-    std::string toXML() const;
+    // Patches are the edit device. State also carries the device layout and the
+    // other devices' values.
+    std::string toXML(bool includeDevices = false) const;
     bool fromXML(const std::string &s);
+    void devicesFromXML(const std::string &s);
     bool fromSYX(const std::vector<uint8_t> &s);
+
+    /*
+     * Patch loads, init and randomize go through here as one transaction. The new
+     * values (-1 leaves a param alone) are staged over the edit device's current
+     * ones, constrained once, published to the audio thread as a single change and
+     * then pushed to the host params which actually moved.
+     */
+    void applyPatchCCs(const PatchCCs &ccs, bool allNotesOff = true);
+    PatchCCs currentPatchCCs() const;
+    void initPatch();
+
+    // Host state is binary. We still read the XML state older versions saved.
+    void toBinaryState(std::vector<uint8_t> &into) const;
+    bool fromBinaryState(const void *data, size_t size);
     void randomizePatch(bool justTweak);
-    void applyPostPatchChangeConstraints();
 
     std::unique_ptr<juce::PropertiesFile> properties;
 
+    // The display name of the preset last loaded, saved with the session so the
+    // editor can find it in the catalogue again. Restoring state flags it for the UI.
+    std::string presetName;
+    std::atomic<bool> presetNameRestored{false};
+
   public:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ElfinControllerAudioProcessor)
 };
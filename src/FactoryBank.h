@@ -0,0 +1,65 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_FACTORYBANK_H
+#define ELFIN_CONTROLLER_FACTORYBANK_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "configuration.h"
+#include "PatchCodec.h"
+
+/*
+ * The factory patch library, packed at build time by elfin-bankgen from
+ * resources/content/patch_library so the plugin never parses a factory patch.
+ * Categories are in name order and each is a run of patches in natural name order.
+ * Names are offsets into one pool of null terminated strings, each stored once.
+ */
+namespace baconpaul::elfin_controller::factory_bank
+{
+static constexpr uint8_t noValue{0xFF};
+
+struct Category
+{
+    uint16_t name;
+    uint16_t first, count;
+};
+
+struct Patch
+{
+    uint16_t name; // the file name without .elfin
+    uint8_t category;
+    uint8_t ccs[nElfinParams]; // noValue where the patch doesn't set the param
+};
+
+extern const char strings[];
+extern const Category categories[];
+extern const size_t nCategories;
+extern const Patch patches[];
+extern const size_t nPatches;
+
+inline const char *nameOf(const Patch &p) { return strings + p.name; }
+inline const char *nameOf(const Category &c) { return strings + c.name; }
+inline const Category &categoryOf(const Patch &p) { return categories[p.category]; }
+
+inline PatchCCs ccsOf(const Patch &p)
+{
+    auto res = emptyPatchCCs();
+    for (int i = 0; i < nElfinParams; ++i)
+        if (p.ccs[i] != noValue)
+            res[i] = p.ccs[i];
+    return res;
+}
+} // namespace baconpaul::elfin_controller::factory_bank
+#endif // FACTORYBANK_H
@@ -0,0 +1,185 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_MIDIPACER_H
+#define ELFIN_CONTROLLER_MIDIPACER_H
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * The Elfin hangs off a 5-pin DIN at 31.25 kbaud, 10 bits on the wire per byte.
+ * That is 320us per byte, so roughly 1ms per 3 byte CC, and the device will drop
+ * things if we stuff more than that down the pipe. The pacer keeps a model of
+ * when the wire becomes free (in microseconds relative to the start of the current
+ * block) and hands out the earliest sample at which a message can go. Anything
+ * which doesn't fit stays pending and the caller retries next block; the wire
+ * time carries over across the block boundary so the spacing is the same at any
+ * sample rate and block size.
+ *
+ * Messages we pass through (notes from the host) can't be moved, so they are
+ * registered as fixed events and the scheduler slots our CCs around them.
+ */
+struct MidiPacer
+{
+    static constexpr double wireBaud{31250.0};
+    static constexpr double microsecondsPerByte{1000000.0 * 10.0 / wireBaud};
+    static constexpr double runningStatusIdleUS{3 * microsecondsPerByte};
+
+    void setSampleRate(double sr)
+    {
+        sampleRate = sr;
+        microsecondsPerSample = 1000000.0 / sr;
+        reset();
+    }
+
+    void reset()
+    {
+        wireFreeAtUS = 0;
+        runningStatus = 0;
+        numFixed = 0;
+        fixedPos = 0;
+    }
+
+    void beginBlock(int ns)
+    {
+        numSamples = ns;
+        numFixed = 0;
+        fixedPos = 0;
+    }
+
+    /*
+     * Register a message which will be sent at an immovable sample position. These
+     * must arrive in time order, which is how a juce::MidiBuffer iterates.
+     */
+    void addFixedEvent(int sample, const uint8_t *data, int size)
+    {
+        if (size <= 0)
+            return;
+
+        FixedEvent fe{sample * microsecondsPerSample, data[0], size};
+        if (numFixed == maxFixedEvents)
+        {
+            // Ridiculously dense input. Just charge the wire for it now.
+            commit(fe);
+            return;
+        }
+        fixed[numFixed++] = fe;
+    }
+
+    /*
+     * Reserve wire time for a message with a status byte and size, no earlier than
+     * earliestSample. Returns the sample offset to emit at, or -1 if the message
+     * doesn't start in this block, in which case nothing is reserved.
+     */
+    int schedule(uint8_t status, int size, int earliestSample = 0)
+    {
+        auto earliestUS = std::max(earliestSample, 0) * microsecondsPerSample;
+        while (true)
+        {
+            auto startUS = std::max(wireFreeAtUS, earliestUS);
+            auto durUS = wireBytesFor(status, size) * microsecondsPerByte;
+
+            if (fixedPos < numFixed && fixed[fixedPos].atUS < startUS + durUS)
+            {
+                commit(fixed[fixedPos]);
+                fixedPos++;
+                continue;
+            }
+
+            auto sample = (int)std::ceil(startUS / microsecondsPerSample - 1e-9);
+            if (sample >= numSamples)
+                return -1;
+
+            wireFreeAtUS = sample * microsecondsPerSample + durUS;
+            updateRunningStatus(status);
+            return sample;
+        }
+    }
+
+    void endBlock()
+    {
+        while (fixedPos < numFixed)
+        {
+            commit(fixed[fixedPos]);
+            fixedPos++;
+        }
+
+        wireFreeAtUS -= numSamples * microsecondsPerSample;
+        if (wireFreeAtUS <= -runningStatusIdleUS)
+        {
+            // The wire has been idle a while. Plenty of interfaces re-send status after
+            // a gap so be conservative and assume the next message pays full freight
+            wireFreeAtUS = -runningStatusIdleUS;
+            runningStatus = 0;
+        }
+    }
+
+    // The first sample at which the wire is free, ignoring fixed events not yet reached
+    int nextFreeSample() const
+    {
+        return (int)std::ceil(std::max(wireFreeAtUS, 0.0) / microsecondsPerSample - 1e-9);
+    }
+    int samplesFor(int bytes) const
+    {
+        return (int)std::ceil(bytes * microsecondsPerByte / microsecondsPerSample);
+    }
+
+    // How much wire time is already committed past the start of this block
+    double backlogInMicroseconds() const { return std::max(wireFreeAtUS, 0.0); }
+
+    int wireBytesFor(uint8_t status, int size) const
+    {
+        if (status == runningStatus && status >= 0x80 && status < 0xF0 && size > 1)
+            return size - 1;
+        return size;
+    }
+
+  protected:
+    struct FixedEvent
+    {
+        double atUS{0};
+        uint8_t status{0};
+        int size{0};
+    };
+
+    void commit(const FixedEvent &fe)
+    {
+        auto startUS = std::max(wireFreeAtUS, fe.atUS);
+        wireFreeAtUS = startUS + wireBytesFor(fe.status, fe.size) * microsecondsPerByte;
+        updateRunningStatus(fe.status);
+    }
+
+    void updateRunningStatus(uint8_t status)
+    {
+        if (status >= 0x80 && status < 0xF0)
+            runningStatus = status;
+        else if (status >= 0xF0 && status < 0xF8)
+            runningStatus = 0; // system common cancels running status; realtime doesn't
+    }
+
+    double sampleRate{48000}, microsecondsPerSample{1000000.0 / 48000};
+    double wireFreeAtUS{0};
+    uint8_t runningStatus{0};
+    int numSamples{0};
+
+    static constexpr int maxFixedEvents{512};
+    std::array<FixedEvent, maxFixedEvents> fixed{};
+    int numFixed{0}, fixedPos{0};
+};
+} // namespace baconpaul::elfin_controller
+#endif // MIDIPACER_H
@@ -0,0 +1,200 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_MODULATORS_H
+#define ELFIN_CONTROLLER_MODULATORS_H
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "configuration.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * A plugin side modulator. The settings are atomics so the UI can poke them; the
+ * evaluation state belongs to the audio thread. Output is a bipolar value which
+ * the bank scales by depth (in CC steps) and adds on top of the target's value.
+ */
+struct Modulator
+{
+    enum Shape
+    {
+        OFF,
+        SINE,
+        TRIANGLE,
+        SAW,
+        SQUARE,
+        SAMPLE_AND_HOLD,
+        STEPS,
+
+        numShapes
+    };
+
+    static constexpr int maxSteps{16};
+
+    std::atomic<int> shape{OFF};
+    std::atomic<int> target{-1};         // ElfinControl
+    std::atomic<int> device{0};          // which ElfinDevice
+    std::atomic<float> cycleBeats{1.f};  // length of one cycle in quarter notes
+    std::atomic<float> depth{32.f};      // in CC steps
+    std::atomic<int> numSteps{8};
+    std::array<std::atomic<float>, maxSteps> steps{}; // -1 .. 1
+
+    Modulator()
+    {
+        // A falling ramp until someone says otherwise
+        for (int i = 0; i < maxSteps; ++i)
+            steps[i] = 1.f - 2.f * i / (maxSteps - 1);
+    }
+
+    bool isActive() const { return shape != OFF && target >= 0 && target < nElfinParams; }
+
+    // phase is in cycles; the integer part is used to seed sample and hold
+    float evaluate(double phase, int seed) const
+    {
+        auto cyc = std::floor(phase);
+        auto ph = (float)(phase - cyc);
+        switch (shape.load(std::memory_order_relaxed))
+        {
+        case SINE:
+            return std::sin(2.f * (float)M_PI * ph);
+        case TRIANGLE:
+            return 1.f - 4.f * std::fabs(ph - 0.5f);
+        case SAW:
+            return 2.f * ph - 1.f;
+        case SQUARE:
+            return ph < 0.5f ? 1.f : -1.f;
+        case SAMPLE_AND_HOLD:
+        {
+            // Hash the cycle so the same bar gets the same value each pass
+            auto h = (uint32_t)((int64_t)cyc * 2654435761u) ^ (uint32_t)(seed * 40503u);
+            h ^= h >> 15;
+            h *= 2246822519u;
+            h ^= h >> 13;
+            return (h & 0xFFFF) / 32767.5f - 1.f;
+        }
+        case STEPS:
+        {
+            auto n = std::clamp(numSteps.load(std::memory_order_relaxed), 1, maxSteps);
+            auto s = std::min((int)(ph * n), n - 1);
+            return steps[s].load(std::memory_order_relaxed);
+        }
+        default:
+            return 0.f;
+        }
+    }
+};
+
+/*
+ * The modulators and their audio thread bookkeeping. A modulator is only evaluated
+ * when its target could actually take a new CC (outside its rate limit and not
+ * still waiting for the wire), so a bank of them costs no more than the link can
+ * carry. Values on the same target sum.
+ */
+struct ModulatorBank
+{
+    static constexpr int maxModulators{16};
+    std::array<Modulator, maxModulators> mods;
+
+    bool anyActive() const
+    {
+        for (auto &m : mods)
+            if (m.isActive())
+                return true;
+        return anyApplied;
+    }
+
+    /*
+     * beat is the host position when playing, or a free running count otherwise.
+     * canTake(dev, param) tells us if the target is ready for another CC and
+     * intervalFor(dev, param) is the minimum samples between sends. apply(dev,
+     * param, offset) sets the summed offset on the target.
+     */
+    template <typename CanTake, typename Interval, typename Apply>
+    void process(double beat, int64_t sampleClock, CanTake &&canTake, Interval &&intervalFor,
+                 Apply &&apply)
+    {
+        std::array<std::pair<int, int>, 2 * maxModulators> dirty;
+        int nDirty{0};
+        auto addDirty = [&](int d, int p)
+        {
+            for (int i = 0; i < nDirty; ++i)
+                if (dirty[i].first == d && dirty[i].second == p)
+                    return;
+            dirty[nDirty++] = {d, p};
+        };
+
+        anyApplied = false;
+        for (int i = 0; i < maxModulators; ++i)
+        {
+            auto &m = mods[i];
+            auto &st = state[i];
+            auto active = m.isActive();
+            auto tgt = active ? m.target.load() : -1;
+            auto dev = m.device.load();
+
+            if (tgt != st.target || dev != st.device)
+            {
+                // Retargeted or switched off, so the old target loses our share
+                if (st.target >= 0)
+                    addDirty(st.device, st.target);
+                st.target = tgt;
+                st.device = dev;
+                st.value = 0;
+                st.nextEval = 0;
+            }
+            if (!active)
+                continue;
+
+            anyApplied = true;
+            if (sampleClock < st.nextEval || !canTake(dev, tgt))
+                continue;
+
+            auto cb = std::max(m.cycleBeats.load(), 1.f / 64.f);
+            auto v = (int)std::lround(m.evaluate(beat / cb, i) * m.depth.load());
+            st.nextEval = sampleClock + intervalFor(dev, tgt);
+            if (v != st.value)
+            {
+                st.value = v;
+                addDirty(dev, tgt);
+            }
+        }
+
+        for (int i = 0; i < nDirty; ++i)
+        {
+            auto [d, p] = dirty[i];
+            int sum{0};
+            for (int j = 0; j < maxModulators; ++j)
+            {
+                if (state[j].target == p && state[j].device == d)
+                    sum += state[j].value;
+            }
+            apply(d, p, std::clamp(sum, -127, 127));
+        }
+    }
+
+  protected:
+    struct State
+    {
+        int target{-1}, device{0}, value{0};
+        int64_t nextEval{0};
+    };
+    std::array<State, maxModulators> state{};
+    bool anyApplied{false};
+};
+} // namespace baconpaul::elfin_controller
+#endif // MODULATORS_H
@@ -0,0 +1,192 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_MOTIONRECORDER_H
+#define ELFIN_CONTROLLER_MOTIONRECORDER_H
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * Records param moves against the host's beat position in to a fixed buffer and
+ * plays them back as a loop while the transport runs. Everything except the
+ * request and the published mode happens on the audio thread, and nothing
+ * allocates or locks. Recording starts when the transport does once armed and
+ * the loop length rounds up to whole beats when it stops.
+ */
+struct MotionRecorder
+{
+    struct Event
+    {
+        double beat{0};
+        int8_t param{0};
+        int8_t value{0};
+    };
+    static constexpr size_t maxEvents{16384};
+
+    enum Mode
+    {
+        STOPPED,
+        ARMED,
+        RECORDING,
+        PLAYING
+    };
+
+    // Any thread
+    void requestMode(Mode m) { request.store(m, std::memory_order_release); }
+    Mode getMode() const { return (Mode)mode.load(std::memory_order_acquire); }
+    bool isIdle() const { return getMode() == STOPPED && request.load() < 0; }
+    bool hasLoop() const { return loopReady.load(std::memory_order_acquire); }
+
+    // Audio thread, once per block before record or play
+    void beginBlock(bool transportPlaying, double ppq, double bpm, double sampleRate,
+                    int numSamples)
+    {
+        auto req = request.exchange(-1, std::memory_order_acq_rel);
+        if (req >= 0)
+        {
+            if (mode == RECORDING)
+                finishRecording();
+
+            switch (req)
+            {
+            case ARMED:
+            case RECORDING:
+                numEvents = 0;
+                loopReady = false;
+                mode = ARMED;
+                break;
+            case PLAYING:
+                mode = loopReady ? PLAYING : STOPPED;
+                needSeek = true;
+                break;
+            default:
+                mode = STOPPED;
+                break;
+            }
+        }
+
+        playing = transportPlaying && bpm > 0;
+        blockBeat = ppq;
+        beatsPerSample = playing ? bpm / 60.0 / sampleRate : 0;
+        blockBeats = beatsPerSample * numSamples;
+
+        if (mode == ARMED && playing)
+        {
+            startBeat = std::floor(ppq);
+            lastBeat = ppq;
+            lastBlockBeats = blockBeats;
+            mode = RECORDING;
+        }
+        else if (mode == RECORDING)
+        {
+            // transport stopped or jumped back; either way that's the take
+            if (!playing || ppq < lastBeat)
+            {
+                finishRecording();
+            }
+            else
+            {
+                lastBeat = ppq;
+                lastBlockBeats = blockBeats;
+            }
+        }
+    }
+
+    // The move lands sampleOffset samples in to the block. Moves needn't arrive in
+    // time order within a block, so each is slotted in behind any later ones.
+    void record(int param, int8_t value, int sampleOffset = 0)
+    {
+        if (mode != RECORDING)
+            return;
+        auto beat = blockBeat - startBeat + std::max(sampleOffset, 0) * beatsPerSample;
+        auto pos = numEvents++;
+        while (pos > 0 && events[pos - 1].beat > beat)
+        {
+            events[pos] = events[pos - 1];
+            pos--;
+        }
+        events[pos] = {beat, (int8_t)param, value};
+        if (numEvents == maxEvents)
+            finishRecording();
+    }
+
+    // emit(param, value, sampleOffset) for every event which falls in this block
+    template <typename F> void play(F &&emit)
+    {
+        if (mode != PLAYING || !playing || numEvents == 0)
+            return;
+
+        auto pos = std::fmod(blockBeat - startBeat, loopBeats);
+        if (pos < 0)
+            pos += loopBeats;
+
+        if (needSeek || std::fabs(pos - expectedPos) > 1e-6)
+        {
+            auto it = std::lower_bound(events.begin(), events.begin() + numEvents, pos,
+                                       [](const Event &e, double b) { return e.beat < b; });
+            cursor = it - events.begin();
+            needSeek = false;
+        }
+
+        auto end = pos + blockBeats;
+        auto emitUntil = [&](double until, double offsetBeats)
+        {
+            while (cursor < numEvents && events[cursor].beat < until)
+            {
+                auto &e = events[cursor];
+                emit(e.param, e.value, (int)((e.beat + offsetBeats - pos) / beatsPerSample));
+                cursor++;
+            }
+        };
+
+        if (end < loopBeats)
+        {
+            emitUntil(end, 0);
+            expectedPos = end;
+        }
+        else
+        {
+            emitUntil(loopBeats, 0);
+            cursor = 0;
+            expectedPos = end - loopBeats;
+            emitUntil(expectedPos, loopBeats);
+        }
+    }
+
+  protected:
+    void finishRecording()
+    {
+        // The stopping block has no length, so use the last one we recorded through
+        loopBeats = std::max(1.0, std::ceil(lastBeat + lastBlockBeats - startBeat));
+        loopReady = numEvents > 0;
+        mode = STOPPED;
+    }
+
+    std::atomic<int> request{-1}, mode{STOPPED};
+    std::atomic<bool> loopReady{false};
+
+    bool playing{false}, needSeek{true};
+    double blockBeat{0}, beatsPerSample{0}, blockBeats{0};
+    double startBeat{0}, lastBeat{0}, lastBlockBeats{0}, loopBeats{1}, expectedPos{0};
+
+    std::array<Event, maxEvents> events{};
+    size_t numEvents{0}, cursor{0};
+};
+} // namespace baconpaul::elfin_controller
+#endif // MOTIONRECORDER_H
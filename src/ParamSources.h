@@ -60,31 +60,17 @@ struct DiscreteParamSource : sst::jucegui::data::Discrete
     }
 
     std::string getLabel() const override { return par->desc.label; }
-    int cacheCC{-1}, cacheLookup{-1};
-    int getValue() const override
-    {
-        auto v = par->getCC();
-        int idx{0};
-        for (auto &d : par->desc.discreteRanges)
-        {
-            if (v >= d.from && v <= d.to)
-                return idx;
-            idx++;
-        }
-        return 0;
-    }
+    int getValue() const override { return par->getDiscreteIndex(); }
     void setValueFromGUI(const int &i) override
     {
         // poly/uni needs an all notes off to avoid hardware device
         // from wedging the voice manager
-        if (par->desc.streaming_name == "poly_uni")
+        if (par->desc.control == POLY_UNI_MODE)
         {
-            panel.processor.sendAllNotesOff = true;
+            auto &proc = panel.processor;
+            proc.devices[proc.editDevice].sendAllNotesOff = true;
         }
-        auto rng = par->desc.discreteRanges[i];
-        auto mid = (rng.from + rng.to) / 2;
-        auto f = par->getFloatForCC(mid);
-        par->setValueNotifyingHost(f);
+        par->setDiscreteIndexNotifyingHost(i);
         if (andThenOnGui)
             andThenOnGui(i);
     }
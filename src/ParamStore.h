@@ -0,0 +1,186 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_PARAMSTORE_H
+#define ELFIN_CONTROLLER_PARAMSTORE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "configuration.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * The CC state for one Elfin, laid out flat so the audio thread touches a couple of
+ * cache lines a block rather than one per parameter. Any thread can set a value; a
+ * change to the quantized CC sets a bit in the dirty mask. The audio thread claims
+ * the whole mask with one exchange, keeps anything it couldn't get on to the wire
+ * in pending, and records what it actually sent in lastSent. A pending value which
+ * is already the last one on the wire isn't sent again unless the whole patch is
+ * being forced out.
+ */
+struct ParamStore
+{
+    static_assert(nElfinParams <= 64, "Dirty mask is a single 64 bit word");
+
+    ParamStore()
+    {
+        for (auto &v : ccValue)
+            v = 0;
+        lastSent.fill(-1);
+        modOffset.fill(0);
+        ccMin.fill(0);
+        ccMax.fill(127);
+    }
+
+    // The legal CC range for idx, which modulation is clamped to
+    void setRange(int idx, int8_t lo, int8_t hi)
+    {
+        ccMin[idx] = lo;
+        ccMax[idx] = hi;
+    }
+
+    int8_t getCC(int idx) const { return ccValue[idx].load(std::memory_order_relaxed); }
+
+    // Returns true if the value changed and is now dirty
+    bool setCC(int idx, int8_t v)
+    {
+        auto old = ccValue[idx].exchange(v, std::memory_order_relaxed);
+        if (old != v)
+        {
+            markDirty(idx);
+            return true;
+        }
+        return false;
+    }
+
+    // Swap expected for v only if nothing else has set the value since. Returns true
+    // if the value changed and is now dirty.
+    bool replaceCC(int idx, int8_t expected, int8_t v)
+    {
+        if (expected == v ||
+            !ccValue[idx].compare_exchange_strong(expected, v, std::memory_order_relaxed))
+            return false;
+        markDirty(idx);
+        return true;
+    }
+
+    // Set a value as part of a batch. The change is flagged in batch rather than the
+    // dirty mask, and publishBatch then flags the lot in one go, so the audio thread
+    // never picks up half of a patch change.
+    bool setCCInBatch(int idx, int8_t v, uint64_t &batch)
+    {
+        auto old = ccValue[idx].exchange(v, std::memory_order_relaxed);
+        if (old != v)
+        {
+            batch |= 1ULL << idx;
+            return true;
+        }
+        return false;
+    }
+    void publishBatch(uint64_t batch)
+    {
+        if (batch)
+            dirty.fetch_or(batch, std::memory_order_release);
+    }
+
+    // Set without flagging for send. Use this for initialization only.
+    void initCC(int idx, int8_t v) { ccValue[idx].store(v, std::memory_order_relaxed); }
+
+    void markDirty(int idx) { dirty.fetch_or(1ULL << idx, std::memory_order_release); }
+    // Send everything, even values the device should already have
+    void markAllDirty()
+    {
+        auto all = nElfinParams == 64 ? ~0ULL : (1ULL << nElfinParams) - 1;
+        forced.fetch_or(all, std::memory_order_release);
+        dirty.fetch_or(all, std::memory_order_release);
+    }
+
+    // Audio thread: fold newly dirty params in to pending and return the lot.
+    // The newly dirty ones alone are left in claimed.
+    uint64_t claimDirty()
+    {
+        claimed = dirty.exchange(0, std::memory_order_acq_rel);
+        pending |= claimed;
+        // Read after dirty, so a racing markAllDirty's bits are never claimed
+        // without its force
+        forcedPending |= forced.exchange(0, std::memory_order_acq_rel);
+        return pending;
+    }
+
+    // Audio thread: the host told us where in the coming block this change lands.
+    // Multiple changes to one param in a block collapse to the last.
+    void setTimed(int idx, int32_t sample)
+    {
+        timed |= 1ULL << idx;
+        timedSample[idx] = sample;
+    }
+
+    // Audio thread: the device told us this value, so there is nothing to send. Drop
+    // any pending send so we don't echo it straight back.
+    void setFromWire(int idx, int8_t v)
+    {
+        auto bit = 1ULL << idx;
+        ccValue[idx].store(v, std::memory_order_relaxed);
+        dirty.fetch_and(~bit, std::memory_order_acq_rel);
+        pending &= ~bit;
+        timed &= ~bit;
+        forcedPending &= ~bit;
+        lastSent[idx] = v;
+    }
+
+    // Audio thread: an offset added to the value at send time but never stored in
+    // it, so modulation doesn't leak in to patches or the UI.
+    void setModOffset(int idx, int off)
+    {
+        if (modOffset[idx] == off)
+            return;
+        modOffset[idx] = (int8_t)off;
+        pending |= 1ULL << idx;
+    }
+
+    // Audio thread: the stored value with any modulation applied
+    int8_t valueForSend(int idx) const
+    {
+        auto v = getCC(idx);
+        if (modOffset[idx])
+            v = (int8_t)std::clamp(v + modOffset[idx], (int)ccMin[idx], (int)ccMax[idx]);
+        return v;
+    }
+
+    // Audio thread: the value we are about to put on the wire for idx
+    int8_t takeForSend(int idx)
+    {
+        pending &= ~(1ULL << idx);
+        timed &= ~(1ULL << idx);
+        forcedPending &= ~(1ULL << idx);
+        auto v = valueForSend(idx);
+        lastSent[idx] = v;
+        return v;
+    }
+
+    alignas(64) std::array<std::atomic<int8_t>, nElfinParams> ccValue;
+    alignas(64) std::atomic<uint64_t> dirty{0};
+    std::atomic<uint64_t> forced{0};
+
+    // Audio thread only
+    alignas(64) uint64_t pending{0}, claimed{0}, timed{0}, forcedPending{0};
+    std::array<int8_t, nElfinParams> lastSent{};
+    std::array<int32_t, nElfinParams> timedSample{};
+    std::array<int8_t, nElfinParams> modOffset{}, ccMin{}, ccMax{};
+};
+} // namespace baconpaul::elfin_controller
+#endif // PARAMSTORE_H
@@ -0,0 +1,454 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#include "PatchCodec.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace baconpaul::elfin_controller
+{
+uint32_t checksumFNV1a(const uint8_t *d, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= d[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void applyPatchConstraints(PatchCCs &ccs)
+{
+    // Poly mode wants Last key assign
+    auto pu = ccs[POLY_UNI_MODE];
+    if (pu >= 0 && elfinConfig[POLY_UNI_MODE].discreteIndexFor(pu) == 0)
+    {
+        ccs[KEY_ASSIGN_MODE] = (int16_t)elfinConfig[KEY_ASSIGN_MODE].ccForDiscreteIndex(3);
+    }
+}
+
+bool decodeSYX(const std::vector<uint8_t> &d, PatchCCs &into)
+{
+    if (d.size() != 108)
+    {
+        ELFLOG("Mis-sized sysex data");
+        return false;
+    }
+    for (auto i = 0U; i < d.size(); i += 3)
+    {
+        if (d[i] != 0xb0)
+        {
+            ELFLOG("Non-control-byte at " << i);
+            return false;
+        }
+    }
+
+    for (auto i = 0U; i < d.size(); i += 3)
+    {
+        int cc = d[i + 1];
+        int va = d[i + 2];
+        auto id = controlByCC[cc & 0x7F];
+        if (id >= 0)
+        {
+            into[id] = (int16_t)std::clamp(va, 0, 127);
+        }
+        else
+        {
+            ELFLOG("Unable to map param " << cc << " val=" << va);
+        }
+    }
+    return true;
+}
+
+namespace
+{
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+bool toInt(std::string_view v, int &res)
+{
+    auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), res);
+    return ec == std::errc() && ptr == v.data() + v.size();
+}
+
+void appendInt(std::string &into, int v)
+{
+    char buf[16];
+    auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+    into.append(buf, ptr - buf);
+}
+} // namespace
+
+bool decodeElfin(std::string_view x, PatchCCs &into)
+{
+    static constexpr auto npos = std::string_view::npos;
+    auto n = x.size();
+    size_t p{0};
+    int depth{0};
+    bool sawElfin{false};
+
+    auto skipPast = [&](std::string_view what)
+    {
+        auto q = x.find(what, p);
+        if (q == npos)
+            return false;
+        p = q + what.size();
+        return true;
+    };
+
+    while (true)
+    {
+        p = x.find('<', p);
+        if (p == npos || ++p >= n)
+            break;
+
+        if (x[p] == '?')
+        {
+            if (!skipPast("?>"))
+                return false;
+            continue;
+        }
+        if (x[p] == '!')
+        {
+            if (!skipPast(x.substr(p, 3) == "!--" ? "-->" : ">"))
+                return false;
+            continue;
+        }
+        if (x[p] == '/')
+        {
+            if (!skipPast(">"))
+                return false;
+            if (--depth <= 0)
+                break;
+            continue;
+        }
+
+        auto ts = p;
+        while (p < n && !isSpace(x[p]) && x[p] != '/' && x[p] != '>')
+            p++;
+        auto tag = x.substr(ts, p - ts);
+        bool isParam = depth == 1 && tag == "param";
+        bool isRoot = depth == 0;
+
+        std::string_view id;
+        int value{0}, version{-1};
+        bool hasValue{false}, selfClosing{false};
+        while (true)
+        {
+            while (p < n && isSpace(x[p]))
+                p++;
+            if (p >= n)
+                return false;
+            if (x[p] == '>')
+            {
+                p++;
+                break;
+            }
+            if (x[p] == '/')
+            {
+                selfClosing = true;
+                p++;
+                continue;
+            }
+
+            auto as = p;
+            while (p < n && !isSpace(x[p]) && x[p] != '=' && x[p] != '>')
+                p++;
+            auto attr = x.substr(as, p - as);
+            while (p < n && isSpace(x[p]))
+                p++;
+            if (p >= n || x[p] != '=')
+                return false;
+            p++;
+            while (p < n && isSpace(x[p]))
+                p++;
+            if (p >= n || (x[p] != '"' && x[p] != '\''))
+                return false;
+            auto q = x.find(x[p], p + 1);
+            if (q == npos)
+                return false;
+            auto val = x.substr(p + 1, q - p - 1);
+            p = q + 1;
+
+            if (isParam)
+            {
+                if (attr == "id")
+                    id = val;
+                else if (attr == "ccval")
+                    hasValue = toInt(val, value);
+            }
+            else if (isRoot && attr == "version")
+            {
+                toInt(val, version);
+            }
+        }
+
+        if (isRoot)
+        {
+            if (tag != "elfin")
+            {
+                ELFLOG("Not Elfin!");
+                return false;
+            }
+            if (version != 1)
+            {
+                ELFLOG("Not version 1!");
+                return false;
+            }
+            sawElfin = true;
+        }
+        else if (isParam && hasValue)
+        {
+            auto c = controlForStreamingName(id);
+            if (c >= 0)
+                into[c] = (int16_t)std::clamp(value, 0, 127);
+        }
+
+        if (!selfClosing)
+            depth++;
+        else if (isRoot)
+            break;
+    }
+
+    if (!sawElfin)
+        ELFLOG("No elfin element found");
+    return sawElfin;
+}
+
+void encodeElfin(const PatchCCs &ccs, std::string &into, bool close)
+{
+    into.clear();
+    into += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n<elfin version=\"1\">\n";
+    for (auto &d : elfinConfig)
+    {
+        if (ccs[d.control] < 0)
+            continue;
+        into += "  <param id=\"";
+        into += d.streaming_name;
+        into += "\" cc=\"";
+        appendInt(into, d.midiCC);
+        into += "\" ccval=\"";
+        appendInt(into, ccs[d.control]);
+        into += "\"/>\n";
+    }
+    if (close)
+        closeElfin(into);
+}
+
+void closeElfin(std::string &into) { into += "</elfin>\n"; }
+
+namespace binstate
+{
+namespace
+{
+constexpr size_t headerSize{8}, sectionHeaderSize{4}, checksumSize{4};
+
+uint32_t readU32(const uint8_t *d)
+{
+    return (uint32_t)d[0] | ((uint32_t)d[1] << 8) | ((uint32_t)d[2] << 16) |
+           ((uint32_t)d[3] << 24);
+}
+} // namespace
+
+bool isBinaryState(const void *data, size_t size)
+{
+    return size >= headerSize + checksumSize && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+Writer::Writer(std::vector<uint8_t> &into) : out(into)
+{
+    start = out.size();
+    out.insert(out.end(), magic, magic + sizeof(magic));
+    addU16(version);
+    addU16(0); // section count, filled in by finish
+}
+
+void Writer::beginSection(Kind kind, int index)
+{
+    endSection();
+    addU8(kind);
+    addU8((uint8_t)index);
+    addU16(0);
+    sectionStart = out.size();
+    inSection = true;
+    nSections++;
+}
+
+void Writer::endSection()
+{
+    if (!inSection)
+        return;
+    auto sz = out.size() - sectionStart;
+    out[sectionStart - 2] = (uint8_t)(sz & 0xFF);
+    out[sectionStart - 1] = (uint8_t)((sz >> 8) & 0xFF);
+    inSection = false;
+}
+
+void Writer::addU16(uint16_t v)
+{
+    out.push_back((uint8_t)(v & 0xFF));
+    out.push_back((uint8_t)(v >> 8));
+}
+
+void Writer::addU32(uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back((uint8_t)((v >> (8 * i)) & 0xFF));
+}
+
+void Writer::addFloat(float f)
+{
+    uint32_t v;
+    std::memcpy(&v, &f, sizeof(v));
+    addU32(v);
+}
+
+void Writer::addString(const std::string &s)
+{
+    // Plenty for a name, and well inside a section's uint16 size
+    auto n = std::min<size_t>(s.size(), 1024);
+    addU16((uint16_t)n);
+    out.insert(out.end(), s.begin(), s.begin() + n);
+}
+
+void Writer::addParams(const PatchCCs &ccs)
+{
+    uint8_t n{0};
+    for (auto v : ccs)
+        n += v >= 0;
+    addU8(n);
+    for (int i = 0; i < nElfinParams; ++i)
+    {
+        if (ccs[i] < 0)
+            continue;
+        addU32(detail::paramIdHashes[i]);
+        addU8((uint8_t)ccs[i]);
+    }
+}
+
+void Writer::finish()
+{
+    endSection();
+    out[start + 6] = (uint8_t)(nSections & 0xFF);
+    out[start + 7] = (uint8_t)(nSections >> 8);
+    addU32(checksumFNV1a(out.data() + start, out.size() - start));
+}
+
+Reader::Reader(const void *data, size_t size) : d((const uint8_t *)data)
+{
+    if (!isBinaryState(data, size))
+        return;
+    if ((d[4] | (d[5] << 8)) > version)
+    {
+        ELFLOG("State is from a newer version");
+        return;
+    }
+    end = size - checksumSize;
+    if (checksumFNV1a(d, end) != readU32(d + end))
+    {
+        ELFLOG("State checksum mismatch");
+        return;
+    }
+    sectionsLeft = d[6] | (d[7] << 8);
+    pos = sectionEnd = headerSize;
+    valid = true;
+}
+
+bool Reader::nextSection(Kind &kind, int &index)
+{
+    if (!valid || sectionsLeft <= 0 || sectionEnd + sectionHeaderSize > end)
+        return false;
+    pos = sectionEnd;
+    kind = (Kind)d[pos];
+    index = d[pos + 1];
+    auto sz = (size_t)(d[pos + 2] | (d[pos + 3] << 8));
+    pos += sectionHeaderSize;
+    if (pos + sz > end)
+        return false;
+    sectionEnd = pos + sz;
+    sectionsLeft--;
+    overrun = false;
+    return true;
+}
+
+uint8_t Reader::getU8()
+{
+    if (pos + 1 > sectionEnd)
+    {
+        overrun = true;
+        return 0;
+    }
+    return d[pos++];
+}
+
+uint16_t Reader::getU16()
+{
+    if (pos + 2 > sectionEnd)
+    {
+        overrun = true;
+        return 0;
+    }
+    auto res = (uint16_t)(d[pos] | (d[pos + 1] << 8));
+    pos += 2;
+    return res;
+}
+
+uint32_t Reader::getU32()
+{
+    if (pos + 4 > sectionEnd)
+    {
+        overrun = true;
+        return 0;
+    }
+    auto res = readU32(d + pos);
+    pos += 4;
+    return res;
+}
+
+float Reader::getFloat()
+{
+    auto v = getU32();
+    float f;
+    std::memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+std::string Reader::getString()
+{
+    auto n = getU16();
+    if (pos + n > sectionEnd)
+    {
+        overrun = true;
+        return {};
+    }
+    std::string res((const char *)d + pos, n);
+    pos += n;
+    return res;
+}
+
+void Reader::getParams(PatchCCs &ccs)
+{
+    auto n = getU8();
+    for (int i = 0; i < n && !overrun; ++i)
+    {
+        auto h = getU32();
+        auto v = getU8();
+        auto c = controlForParamIdHash(h, i);
+        if (!overrun && c >= 0)
+            ccs[c] = (int16_t)std::clamp<int>(v, 0, 127);
+    }
+}
+} // namespace binstate
+} // namespace baconpaul::elfin_controller
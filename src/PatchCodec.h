@@ -0,0 +1,256 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_PATCHCODEC_H
+#define ELFIN_CONTROLLER_PATCHCODEC_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "configuration.h"
+
+namespace baconpaul::elfin_controller
+{
+// A CC value for each control, or -1 where the patch didn't have one
+using PatchCCs = std::array<int16_t, nElfinParams>;
+
+inline PatchCCs emptyPatchCCs()
+{
+    PatchCCs res;
+    res.fill(-1);
+    return res;
+}
+
+// For the checksums on our binary formats
+uint32_t checksumFNV1a(const uint8_t *d, size_t n);
+
+// Fix up combinations the Elfin doesn't want, on a full patch
+void applyPatchConstraints(PatchCCs &ccs);
+
+// The .syx patch dump, which is 36 CC messages on channel 1
+bool decodeSYX(const std::vector<uint8_t> &data, PatchCCs &into);
+
+/*
+ * The .elfin format is XML, but only ever a flat list of <param id=".." ccval=".."/>
+ * under <elfin version="1">. Rather than build a DOM we scan the text once, look
+ * the id up in a perfect hash of the streaming names and take the value. Only
+ * params which are direct children of <elfin> count, so plugin state (which nests
+ * more params under its devices and morph slots) reads the same way. Unknown ids,
+ * like the exp_by_vel in some factory patches, are skipped.
+ */
+bool decodeElfin(std::string_view xml, PatchCCs &into);
+
+// Write the header and params in to into, which is cleared but keeps its capacity.
+// Leave the document open if you want to append more elements, then closeElfin.
+void encodeElfin(const PatchCCs &ccs, std::string &into, bool close = true);
+void closeElfin(std::string &into);
+
+namespace detail
+{
+constexpr size_t nameLength(const char *s)
+{
+    size_t n{0};
+    while (s[n])
+        n++;
+    return n;
+}
+
+constexpr uint32_t nameHash(const char *s, size_t n, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// FNV's low bits only see the low bits of the seed, so slot on the high bits
+static constexpr int nameHashBits{7};
+static constexpr size_t nameHashSize{1u << nameHashBits};
+static_assert(nameHashSize >= nElfinParams);
+constexpr size_t nameSlot(uint32_t h) { return h >> (32 - nameHashBits); }
+
+constexpr uint32_t findPerfectNameSeed()
+{
+    for (uint32_t seed = 0; seed < 10000; ++seed)
+    {
+        std::array<bool, nameHashSize> used{};
+        bool ok{true};
+        for (auto &d : elfinConfig)
+        {
+            auto slot = nameSlot(nameHash(d.streaming_name, nameLength(d.streaming_name), seed));
+            if (used[slot])
+            {
+                ok = false;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (ok)
+            return seed;
+    }
+    return ~0u;
+}
+
+inline constexpr uint32_t perfectNameSeed = findPerfectNameSeed();
+static_assert(perfectNameSeed != ~0u, "No perfect hash seed for the streaming names");
+
+constexpr std::array<int8_t, nameHashSize> makeControlByNameHash()
+{
+    std::array<int8_t, nameHashSize> res{};
+    for (auto &v : res)
+        v = -1;
+    for (auto &d : elfinConfig)
+        res[nameSlot(nameHash(d.streaming_name, nameLength(d.streaming_name), perfectNameSeed))] =
+            (int8_t)d.control;
+    return res;
+}
+inline constexpr std::array<int8_t, nameHashSize> controlByNameHash = makeControlByNameHash();
+} // namespace detail
+
+// The control with this streaming name, or -1
+inline int controlForStreamingName(std::string_view n)
+{
+    auto c = detail::controlByNameHash[detail::nameSlot(
+        detail::nameHash(n.data(), n.size(), detail::perfectNameSeed))];
+    if (c < 0 || n != elfinConfig[c].streaming_name)
+        return -1;
+    return c;
+}
+
+/*
+ * Plugin state as a compact binary chunk, since hosts save it far more often than
+ * users save patches. Everything is little endian:
+ *
+ *   "ELFS", uint16 version, uint16 section count
+ *   sections of uint8 kind, uint8 index, uint16 payload size, payload
+ *   uint32 FNV-1a checksum of everything before it
+ *
+ * A param section is a uint8 count then count (uint32 id hash, uint8 ccval) pairs.
+ * The id hash is the FNV-1a of the streaming name, so it survives reordering the
+ * table. Readers skip sections and ids they don't know.
+ */
+namespace binstate
+{
+static constexpr uint8_t magic[4]{'E', 'L', 'F', 'S'};
+static constexpr uint16_t version{1};
+
+enum Kind : uint8_t
+{
+    PARAMS = 1, // index is the device
+    DEVICES,    // count, edit device, then a channel per device
+    MORPH,      // params, index is the slot
+    MODULATOR,  // index is the modulator
+    PRESET,     // the display name of the last loaded preset
+};
+
+constexpr uint32_t paramIdHash(const char *s, size_t n)
+{
+    return elfin_controller::detail::nameHash(s, n, 0);
+}
+
+namespace detail
+{
+constexpr std::array<uint32_t, nElfinParams> makeParamIdHashes()
+{
+    std::array<uint32_t, nElfinParams> res{};
+    for (auto &d : elfinConfig)
+        res[d.control] =
+            paramIdHash(d.streaming_name, elfin_controller::detail::nameLength(d.streaming_name));
+    return res;
+}
+inline constexpr std::array<uint32_t, nElfinParams> paramIdHashes = makeParamIdHashes();
+
+constexpr bool paramIdHashesAreUnique()
+{
+    for (int i = 0; i < nElfinParams; ++i)
+        for (int j = i + 1; j < nElfinParams; ++j)
+            if (paramIdHashes[i] == paramIdHashes[j])
+                return false;
+    return true;
+}
+static_assert(paramIdHashesAreUnique(), "Streaming names collide in the state id hash");
+} // namespace detail
+
+// The control for an id hash, or -1. We write in table order, so try the hint first.
+inline int controlForParamIdHash(uint32_t h, int hint)
+{
+    if (hint >= 0 && hint < nElfinParams && detail::paramIdHashes[hint] == h)
+        return hint;
+    for (int i = 0; i < nElfinParams; ++i)
+        if (detail::paramIdHashes[i] == h)
+            return i;
+    return -1;
+}
+
+bool isBinaryState(const void *data, size_t size);
+
+// Appends a chunk to into. Open a section, add to it, and finish when done.
+struct Writer
+{
+    explicit Writer(std::vector<uint8_t> &into);
+
+    void beginSection(Kind kind, int index);
+    void addU8(uint8_t v) { out.push_back(v); }
+    void addU16(uint16_t v);
+    void addU32(uint32_t v);
+    void addFloat(float f);
+    // A uint16 length and the bytes
+    void addString(const std::string &s);
+    // The params which are set (>= 0) in ccs
+    void addParams(const PatchCCs &ccs);
+    void finish();
+
+  private:
+    void endSection();
+    std::vector<uint8_t> &out;
+    size_t start{0}, sectionStart{0};
+    uint16_t nSections{0};
+    bool inSection{false};
+};
+
+/*
+ * Checks the header and checksum on construction. Then nextSection walks the
+ * sections and the get functions read the current one. Reading past the end of a
+ * section gives zeros and marks it bad; check sectionOK before using what you read.
+ */
+struct Reader
+{
+    Reader(const void *data, size_t size);
+
+    bool isValid() const { return valid; }
+    bool nextSection(Kind &kind, int &index);
+    bool sectionOK() const { return !overrun; }
+
+    uint8_t getU8();
+    uint16_t getU16();
+    uint32_t getU32();
+    float getFloat();
+    std::string getString();
+    // Set the known params in the section in to ccs
+    void getParams(PatchCCs &ccs);
+
+  private:
+    const uint8_t *d{nullptr};
+    size_t end{0}, pos{0}, sectionEnd{0};
+    int sectionsLeft{0};
+    bool valid{false}, overrun{false};
+};
+} // namespace binstate
+} // namespace baconpaul::elfin_controller
+#endif // PATCHCODEC_H
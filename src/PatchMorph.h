@@ -0,0 +1,101 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_PATCHMORPH_H
+#define ELFIN_CONTROLLER_PATCHMORPH_H
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "configuration.h"
+#include "ParamStore.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * Two captured CC vectors and the rule for blending between them. Continuous
+ * params interpolate and round to a CC; params with discrete ranges flip from A
+ * to B at the threshold since halfway between two waveforms is a third waveform.
+ * apply() writes in to a store, which only flags the CCs whose quantized value
+ * actually moved, so a sweep costs what it changes and the pacer does the rest.
+ */
+struct PatchMorph
+{
+    static constexpr float discreteThreshold{0.5f};
+    enum Slot
+    {
+        A,
+        B
+    };
+
+    PatchMorph()
+    {
+        for (auto &s : slots)
+            for (auto &v : s)
+                v = 0;
+    }
+
+    void capture(Slot which, const ParamStore &from)
+    {
+        for (int i = 0; i < nElfinParams; ++i)
+            slots[which][i].store(from.getCC(i), std::memory_order_relaxed);
+        hasSlot[which].store(true, std::memory_order_release);
+    }
+
+    void setSlotCC(Slot which, int idx, int8_t v)
+    {
+        slots[which][idx].store(v, std::memory_order_relaxed);
+        hasSlot[which].store(true, std::memory_order_release);
+    }
+    int8_t getSlotCC(Slot which, int idx) const
+    {
+        return slots[which][idx].load(std::memory_order_relaxed);
+    }
+
+    void clear()
+    {
+        hasSlot[A] = false;
+        hasSlot[B] = false;
+    }
+    bool isReady() const { return hasSlot[A] && hasSlot[B]; }
+    bool hasCaptured(Slot which) const { return hasSlot[which]; }
+
+    int8_t valueAt(int idx, float m) const
+    {
+        auto a = getSlotCC(A, idx);
+        auto b = getSlotCC(B, idx);
+        if (elfinConfig[idx].hasDiscreteRanges())
+            return m < discreteThreshold ? a : b;
+        return (int8_t)std::lround(a + (b - a) * m);
+    }
+
+    // Returns how many CCs changed
+    int apply(float m, ParamStore &to) const
+    {
+        int changed{0};
+        for (int i = 0; i < nElfinParams; ++i)
+        {
+            if (to.setCC(i, valueAt(i, m)))
+                changed++;
+        }
+        return changed;
+    }
+
+  protected:
+    std::array<std::array<std::atomic<int8_t>, nElfinParams>, 2> slots;
+    std::array<std::atomic<bool>, 2> hasSlot{};
+};
+} // namespace baconpaul::elfin_controller
+#endif // PATCHMORPH_H
@@ -0,0 +1,278 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#include "PatchSimilarity.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ELFIN_SIMILARITY_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ELFIN_SIMILARITY_NEON 1
+#endif
+
+namespace baconpaul::elfin_controller
+{
+namespace
+{
+// How each param lands in a row, packed small so building doesn't walk the
+// whole description table for every patch
+struct Slot
+{
+    uint8_t offset{0};
+    int8_t nRanges{0};
+    int16_t defaultCC{0}, start{0}, span{1};
+    int32_t scale{0}; // 127 / span in 16.16
+};
+struct Layout
+{
+    std::array<Slot, nElfinParams> slots{};
+    int size{0};
+};
+constexpr Layout makeLayout()
+{
+    Layout res;
+    int at{0};
+    for (auto &d : elfinConfig)
+    {
+        auto &s = res.slots[d.control];
+        s.offset = (uint8_t)at;
+        s.nRanges = (int8_t)d.discreteRanges.size();
+        s.defaultCC = (int16_t)d.midiCCDefault;
+        s.start = d.midiCCStart;
+        s.span = (int16_t)std::max(1, d.midiCCEnd - d.midiCCStart);
+        s.scale = (127 * 65536 + s.span / 2) / s.span;
+        at += d.hasDiscreteRanges() ? (int)d.discreteRanges.size() : 1;
+    }
+    res.size = at;
+    return res;
+}
+constexpr Layout layout = makeLayout();
+static_assert(layout.size <= PatchSimilarity::featureSize, "Too many features for a row");
+static_assert(PatchSimilarity::featureSize % 16 == 0);
+
+// Below this many patches a thread costs more than it saves
+static constexpr size_t minPatchesPerThread{4096};
+
+int canonicalCC(const PatchCCs &ccs, int i)
+{
+    return ccs[i] < 0 ? layout.slots[i].defaultCC : ccs[i] & 0x7F;
+}
+
+bool isEmpty(const PatchCCs &ccs)
+{
+    return std::all_of(ccs.begin(), ccs.end(), [](auto c) { return c < 0; });
+}
+
+template <typename F> void forChunks(size_t n, int threads, F &&f)
+{
+    if (threads <= 0)
+        threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    auto nt = std::clamp<size_t>(n / minPatchesPerThread, 1, (size_t)threads);
+    if (nt == 1)
+    {
+        f(0, n);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    auto per = (n + nt - 1) / nt;
+    for (size_t s = per; s < n; s += per)
+        workers.emplace_back([&f, s, e = std::min(n, s + per)]() { f(s, e); });
+    f(0, std::min(n, per));
+    for (auto &w : workers)
+        w.join();
+}
+} // namespace
+
+PatchSimilarity::Features PatchSimilarity::featuresFor(const PatchCCs &ccs)
+{
+    Features res;
+    for (int i = 0; i < nElfinParams; ++i)
+    {
+        auto &s = layout.slots[i];
+        auto cc = canonicalCC(ccs, i);
+        if (s.nRanges)
+        {
+            res.v[s.offset + elfinConfig[i].discreteIndexFor(cc)] = (uint8_t)(discreteWeight / 2);
+        }
+        else
+        {
+            auto v = std::clamp(cc - (int)s.start, 0, (int)s.span);
+            res.v[s.offset] = (uint8_t)((v * s.scale + 32768) >> 16);
+        }
+    }
+    return res;
+}
+
+uint64_t PatchSimilarity::contentHash(const PatchCCs &ccs)
+{
+    // 64 bits, since 32 would expect a collision somewhere in a big shared library
+    uint64_t h = 14695981039346656037ull;
+    for (int i = 0; i < nElfinParams; ++i)
+    {
+        h ^= (uint8_t)canonicalCC(ccs, i);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+uint32_t PatchSimilarity::distance(const Features &a, const Features &b)
+{
+#if ELFIN_SIMILARITY_SSE2
+    auto acc = _mm_setzero_si128();
+    for (int i = 0; i < featureSize; i += 16)
+    {
+        auto x = _mm_load_si128(reinterpret_cast<const __m128i *>(a.v.data() + i));
+        auto y = _mm_load_si128(reinterpret_cast<const __m128i *>(b.v.data() + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(x, y));
+    }
+    return (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#elif ELFIN_SIMILARITY_NEON
+    auto acc = vdupq_n_u16(0);
+    for (int i = 0; i < featureSize; i += 16)
+        acc = vpadalq_u8(acc, vabdq_u8(vld1q_u8(a.v.data() + i), vld1q_u8(b.v.data() + i)));
+    return vaddlvq_u16(acc);
+#else
+    uint32_t res{0};
+    for (int i = 0; i < featureSize; ++i)
+        res += (uint32_t)std::abs((int)a.v[i] - (int)b.v[i]);
+    return res;
+#endif
+}
+
+void PatchSimilarity::clear()
+{
+    rows.clear();
+    valid.clear();
+    hashes.clear();
+    dupFirst.clear();
+    dupNext.clear();
+}
+
+void PatchSimilarity::build(const std::vector<PatchCCs> &factory,
+                            const std::vector<PatchCCs> &user, int threads)
+{
+    auto n = factory.size() + user.size();
+    rows.assign(n, Features{});
+    valid.assign(n, 0);
+    hashes.assign(n, 0);
+
+    forChunks(n, threads,
+              [&](size_t s, size_t e)
+              {
+                  for (auto i = s; i < e; ++i)
+                  {
+                      auto &ccs = i < factory.size() ? factory[i] : user[i - factory.size()];
+                      if (isEmpty(ccs))
+                          continue;
+                      valid[i] = 1;
+                      rows[i] = featuresFor(ccs);
+                      hashes[i] = contentHash(ccs);
+                  }
+              });
+
+    // Chain up the duplicates with an open addressed table of the last patch seen
+    // with each hash, which is one pass rather than a sort
+    dupFirst.assign(n, -1);
+    dupNext.assign(n, -1);
+    int bits{4};
+    while ((size_t(1) << bits) < n * 2)
+        bits++;
+    auto mask = (size_t(1) << bits) - 1;
+    std::vector<int32_t> last(mask + 1, -1);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!valid[i])
+            continue;
+        auto slot = (size_t)(hashes[i] >> (64 - bits));
+        while (last[slot] >= 0 && hashes[last[slot]] != hashes[i])
+            slot = (slot + 1) & mask;
+        auto prior = last[slot];
+        dupFirst[i] = prior >= 0 ? dupFirst[prior] : (int32_t)i;
+        if (prior >= 0)
+            dupNext[prior] = (int32_t)i;
+        last[slot] = (int32_t)i;
+    }
+}
+
+std::vector<PatchSimilarity::Match> PatchSimilarity::scan(const Features &f, int n,
+                                                          int exclude) const
+{
+    std::vector<Match> best;
+    if (n <= 0)
+        return best;
+    best.reserve(n + 1);
+
+    // Visiting in index order and only taking strictly nearer patches keeps the
+    // lower index among equals
+    uint32_t worst = UINT32_MAX;
+    for (int32_t i = 0; i < (int32_t)rows.size(); ++i)
+    {
+        auto d = distance(f, rows[i]);
+        if (d >= worst || !valid[i] || i == exclude)
+            continue;
+
+        auto at = std::upper_bound(best.begin(), best.end(), d,
+                                   [](uint32_t v, const Match &m) { return v < m.distance; });
+        best.insert(at, {i, d});
+        if ((int)best.size() > n)
+            best.pop_back();
+        if ((int)best.size() == n)
+            worst = best.back().distance;
+    }
+    return best;
+}
+
+std::vector<PatchSimilarity::Match> PatchSimilarity::nearest(const PatchCCs &ccs, int n) const
+{
+    return scan(featuresFor(ccs), n, -1);
+}
+
+std::vector<PatchSimilarity::Match> PatchSimilarity::nearestTo(int index, int n) const
+{
+    if (!isValid(index))
+        return {};
+    return scan(rows[index], n, index);
+}
+
+std::vector<int32_t> PatchSimilarity::duplicatesOf(int index) const
+{
+    std::vector<int32_t> res;
+    if (!isValid(index))
+        return res;
+
+    for (auto i = dupFirst[index]; i >= 0; i = dupNext[i])
+        if (i != index)
+            res.push_back(i);
+    return res;
+}
+
+std::vector<std::vector<int32_t>> PatchSimilarity::duplicateGroups() const
+{
+    std::vector<std::vector<int32_t>> res;
+    for (int32_t i = 0; i < (int32_t)size(); ++i)
+    {
+        if (dupFirst[i] != i || dupNext[i] < 0)
+            continue;
+        auto &g = res.emplace_back();
+        for (auto j = i; j >= 0; j = dupNext[j])
+            g.push_back(j);
+    }
+    return res;
+}
+} // namespace baconpaul::elfin_controller
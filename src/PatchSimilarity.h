@@ -0,0 +1,93 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_PATCHSIMILARITY_H
+#define ELFIN_CONTROLLER_PATCHSIMILARITY_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "configuration.h"
+#include "PatchCodec.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * Finds the patches which sound nearest to a patch, and the ones which are exact
+ * copies of each other, across the whole catalogue.
+ *
+ * Each patch becomes a row of featureSize bytes. A continuous param is its CC
+ * stretched over 0..127 from its CC range. A discrete param gets a byte per range,
+ * with discreteWeight / 2 in the one it falls in, so two patches in different
+ * ranges are discreteWeight apart and two in the same range are the same however
+ * far apart their CCs are. The distance between patches is then the sum of absolute
+ * differences of their rows, which is a handful of SAD instructions per patch.
+ *
+ * Patches are numbered as in the catalogue: factory first, then user. A patch
+ * which couldn't be read has no features and never matches anything.
+ */
+struct PatchSimilarity
+{
+    static constexpr int featureSize{64};
+    static constexpr int discreteWeight{64};
+
+    struct alignas(16) Features
+    {
+        std::array<uint8_t, featureSize> v{};
+    };
+
+    struct Match
+    {
+        int32_t index{-1};
+        uint32_t distance{0};
+    };
+    static constexpr int defaultMatches{20};
+
+    // Build from the catalogue, computing the rows on several threads when there are
+    // enough patches to be worth it. threads of 0 means one per core.
+    void build(const std::vector<PatchCCs> &factory, const std::vector<PatchCCs> &user,
+               int threads = 0);
+    void clear();
+
+    size_t size() const { return rows.size(); }
+    bool isValid(int index) const { return index >= 0 && index < (int)size() && valid[index]; }
+
+    // The nearest n patches to ccs, or to a catalogue patch leaving out itself. Nearest
+    // first, and index order among equals.
+    std::vector<Match> nearest(const PatchCCs &ccs, int n = defaultMatches) const;
+    std::vector<Match> nearestTo(int index, int n = defaultMatches) const;
+
+    // The other patches with exactly the same CCs as index, in catalogue order
+    std::vector<int32_t> duplicatesOf(int index) const;
+    // Every set of two or more identical patches
+    std::vector<std::vector<int32_t>> duplicateGroups() const;
+
+    // Missing CCs count as the default, so a patch which leaves out a param is the
+    // same as one which sets it to the default
+    static Features featuresFor(const PatchCCs &ccs);
+    static uint64_t contentHash(const PatchCCs &ccs);
+    static uint32_t distance(const Features &a, const Features &b);
+
+  protected:
+    std::vector<Match> scan(const Features &f, int n, int exclude) const;
+
+    std::vector<Features> rows;
+    std::vector<uint8_t> valid;
+    std::vector<uint64_t> hashes;
+    // Identical patches are chained in catalogue order: the first of each set, and
+    // the next one along or -1
+    std::vector<int32_t> dupFirst, dupNext;
+};
+} // namespace baconpaul::elfin_controller
+#endif // PATCHSIMILARITY_H
@@ -0,0 +1,534 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#include "PresetIndex.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace baconpaul::elfin_controller
+{
+namespace
+{
+/*
+ * The index file is little endian:
+ *
+ *   "ELFI", uint32 version, uint32 param count, uint32 folder count
+ *   per folder: string path, int64 mtime, uint32 subfolder count, strings,
+ *     uint32 entry count, then per entry string name, int64 mtime, uint64 size,
+ *     uint8 valid and a CC (or -1) per param
+ *   uint32 FNV-1a checksum of everything before it
+ *
+ * Strings are a uint32 length and the UTF-8 bytes.
+ */
+constexpr char indexMagic[4]{'E', 'L', 'F', 'I'};
+constexpr uint32_t indexVersion{1};
+
+// Every instance scans on its own, so each write needs a temp file no other
+// instance, here or in another process, can be writing at the same time
+std::string uniqueTempSuffix()
+{
+    static std::atomic<uint32_t> counter{0};
+#if defined(_WIN32)
+    auto pid = (long)_getpid();
+#else
+    auto pid = (long)getpid();
+#endif
+    return "." + std::to_string(pid) + "." + std::to_string(counter.fetch_add(1)) + ".tmp";
+}
+
+struct Out
+{
+    std::string buf;
+    void u32(uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            buf.push_back((char)((v >> (8 * i)) & 0xFF));
+    }
+    void u64(uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            buf.push_back((char)((v >> (8 * i)) & 0xFF));
+    }
+    void str(const std::string &s)
+    {
+        u32((uint32_t)s.size());
+        buf += s;
+    }
+};
+
+struct In
+{
+    const uint8_t *d;
+    size_t end, pos{0};
+    bool ok{true};
+
+    bool need(size_t n)
+    {
+        if (!ok || pos + n > end)
+            ok = false;
+        return ok;
+    }
+    uint8_t u8() { return need(1) ? d[pos++] : 0; }
+    uint32_t u32()
+    {
+        uint32_t v{0};
+        if (need(4))
+            for (int i = 0; i < 4; ++i)
+                v |= (uint32_t)d[pos++] << (8 * i);
+        return v;
+    }
+    uint64_t u64()
+    {
+        uint64_t v{0};
+        if (need(8))
+            for (int i = 0; i < 8; ++i)
+                v |= (uint64_t)d[pos++] << (8 * i);
+        return v;
+    }
+    std::string str()
+    {
+        auto n = u32();
+        if (!need(n))
+            return {};
+        std::string res((const char *)d + pos, n);
+        pos += n;
+        return res;
+    }
+};
+
+bool isPatchFile(const fs::path &p)
+{
+    auto e = p.extension();
+    return e == ".elfin" || e == ".syx";
+}
+
+int64_t mtimeOf(const fs::path &p, std::error_code &ec)
+{
+    return (int64_t)fs::last_write_time(p, ec).time_since_epoch().count();
+}
+} // namespace
+
+bool PresetIndex::statFile(const fs::path &p, int64_t &mtime, uint64_t &size)
+{
+    std::error_code ec;
+    mtime = mtimeOf(p, ec);
+    if (!ec)
+        size = (uint64_t)fs::file_size(p, ec);
+    return !ec;
+}
+
+std::string PresetIndex::naturalSortKey(const std::string &s)
+{
+    std::string res;
+    res.reserve(s.size() + 8);
+    for (size_t i = 0; i < s.size();)
+    {
+        auto c = (unsigned char)s[i];
+        if (c >= '0' && c <= '9')
+        {
+            auto st = i;
+            while (i < s.size() && s[i] >= '0' && s[i] <= '9')
+                i++;
+            auto nz = st;
+            while (nz < i - 1 && s[nz] == '0')
+                nz++;
+            // Keep the run where a digit would sort against letters, then longer
+            // numbers after shorter ones, then the digits themselves
+            res.push_back('0');
+            res.push_back((char)('0' + std::min<size_t>(i - nz, 200)));
+            res.append(s, nz, i - nz);
+            continue;
+        }
+        res.push_back(c < 128 ? (char)std::tolower(c) : (char)c);
+        i++;
+    }
+    return res;
+}
+
+std::string PresetIndex::folderSortKey(const std::string &rel)
+{
+    auto res = naturalSortKey(rel);
+    std::replace(res.begin(), res.end(), '/', '\x02');
+    return res;
+}
+
+void PresetIndex::readEntry(const fs::path &p, Entry &e)
+{
+    e.ccs = emptyPatchCCs();
+    e.valid = false;
+
+    std::ifstream f(p, std::ios::in | std::ios::binary);
+    if (!f.is_open())
+        return;
+    std::string s((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    if (p.extension() == ".syx")
+        e.valid = decodeSYX(std::vector<uint8_t>(s.begin(), s.end()), e.ccs);
+    else
+        e.valid = decodeElfin(s, e.ccs);
+}
+
+bool PresetIndex::scanFolder(const std::string &rel, std::map<std::string, Folder> &into,
+                             const std::atomic<bool> &stop, bool recurseKnown)
+{
+    if (stop)
+        return false;
+
+    auto abs = rel.empty() ? root : root / fs::u8path(rel);
+    std::error_code ec;
+    if (!fs::is_directory(abs, ec))
+        return false;
+    auto mtime = mtimeOf(abs, ec);
+    if (ec)
+        return false;
+
+    bool changed{false};
+    Folder f;
+    auto old = folders.find(rel);
+    bool relist = old == folders.end() || old->second.mtime != mtime;
+
+    if (!relist)
+    {
+        f = old->second;
+        for (auto &e : f.entries)
+        {
+            auto p = abs / fs::u8path(e.name);
+            auto mt = mtimeOf(p, ec);
+            auto sz = ec ? 0 : (uint64_t)fs::file_size(p, ec);
+            if (ec)
+            {
+                // Gone without the folder noticing, so trust the disk
+                relist = true;
+                break;
+            }
+            if (mt != e.mtime || sz != e.size)
+            {
+                e.mtime = mt;
+                e.size = sz;
+                readEntry(p, e);
+                changed = true;
+            }
+        }
+    }
+
+    if (relist)
+    {
+        // Writing our own index touches the root, so a relist is only a change if the
+        // listing or a file turns out different
+        std::map<std::string, const Entry *> known;
+        if (old != folders.end())
+            for (auto &e : old->second.entries)
+                known[e.name] = &e;
+
+        f = Folder();
+        f.mtime = mtime;
+        f.sortKey = folderSortKey(rel);
+        for (auto it = fs::directory_iterator(abs, ec); !ec && it != fs::directory_iterator();
+             it.increment(ec))
+        {
+            if (stop)
+                return false;
+
+            auto p = it->path();
+            auto name = p.filename().u8string();
+            std::error_code fec;
+            if (it->is_directory(fec))
+            {
+                f.subfolders.push_back(name);
+                continue;
+            }
+            if (!it->is_regular_file(fec) || !isPatchFile(p))
+                continue;
+
+            Entry e;
+            e.name = name;
+            e.sortKey = naturalSortKey(name);
+            e.mtime = mtimeOf(p, fec);
+            e.size = fec ? 0 : (uint64_t)fs::file_size(p, fec);
+            auto k = known.find(name);
+            if (k != known.end() && k->second->mtime == e.mtime && k->second->size == e.size)
+            {
+                e.valid = k->second->valid;
+                e.ccs = k->second->ccs;
+            }
+            else
+            {
+                readEntry(p, e);
+                changed = true;
+            }
+            f.entries.push_back(std::move(e));
+        }
+
+        if (old == folders.end() || f.entries.size() != known.size())
+        {
+            changed = true;
+        }
+        else
+        {
+            auto a = f.subfolders, b = old->second.subfolders;
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+            changed |= a != b;
+        }
+    }
+
+    for (auto &s : f.subfolders)
+    {
+        auto sub = rel.empty() ? s : rel + "/" + s;
+        if (recurseKnown || folders.find(sub) == folders.end())
+            changed |= scanFolder(sub, into, stop, recurseKnown);
+    }
+
+    into[rel] = std::move(f);
+    return changed;
+}
+
+bool PresetIndex::update(const std::atomic<bool> &stop)
+{
+    std::map<std::string, Folder> next;
+    auto changed = scanFolder("", next, stop);
+    if (stop)
+        return false;
+
+    // A folder which went away changes its parent, but check in case it was the root
+    changed |= next.size() != folders.size();
+    folders = std::move(next);
+    return changed;
+}
+
+fs::path PresetIndex::patchPath(const std::string &rel, const std::string &name)
+{
+    return rel.empty() ? fs::u8path(name) : fs::u8path(rel) / fs::u8path(name);
+}
+
+void PresetIndex::dropFolder(const std::string &rel, std::vector<Change> &changes)
+{
+    auto f = folders.find(rel);
+    if (f == folders.end())
+        return;
+    auto subs = std::move(f->second.subfolders);
+    for (auto &e : f->second.entries)
+        changes.push_back({Change::REMOVED, patchPath(rel, e.name), e.ccs});
+    folders.erase(f);
+    for (auto &s : subs)
+        dropFolder(rel.empty() ? s : rel + "/" + s, changes);
+}
+
+void PresetIndex::updateFolders(const std::vector<std::string> &rels,
+                                std::vector<Change> &changes, const std::atomic<bool> &stop)
+{
+    for (auto &rel : rels)
+    {
+        // A folder we don't know yet turns up through its parent's listing
+        auto old = folders.find(rel);
+        if (old == folders.end())
+            continue;
+
+        std::map<std::string, Folder> fresh;
+        scanFolder(rel, fresh, stop, false);
+        if (stop)
+            return;
+
+        auto nf = fresh.find(rel);
+        if (nf == fresh.end())
+        {
+            dropFolder(rel, changes);
+            continue;
+        }
+
+        std::map<std::string, const Entry *> was;
+        for (auto &e : old->second.entries)
+            was[e.name] = &e;
+        for (auto &e : nf->second.entries)
+        {
+            auto w = was.find(e.name);
+            if (w == was.end())
+            {
+                changes.push_back(
+                    {Change::ADDED, patchPath(rel, e.name), e.ccs, e.mtime, e.size});
+                continue;
+            }
+            if (w->second->mtime != e.mtime || w->second->size != e.size)
+                changes.push_back(
+                    {Change::UPDATED, patchPath(rel, e.name), e.ccs, e.mtime, e.size});
+            was.erase(w);
+        }
+        for (auto &[n, e] : was)
+            changes.push_back({Change::REMOVED, patchPath(rel, n), e->ccs});
+
+        auto gone = old->second.subfolders;
+        for (auto &s : nf->second.subfolders)
+            gone.erase(std::remove(gone.begin(), gone.end(), s), gone.end());
+        for (auto &s : gone)
+            dropFolder(rel.empty() ? s : rel + "/" + s, changes);
+
+        // Everything else in fresh is a folder we hadn't seen
+        for (auto &[k, f] : fresh)
+        {
+            if (k != rel)
+                for (auto &e : f.entries)
+                    changes.push_back(
+                        {Change::ADDED, patchPath(k, e.name), e.ccs, e.mtime, e.size});
+            folders[k] = std::move(f);
+        }
+    }
+}
+
+std::vector<PresetIndex::Patch> PresetIndex::sortedPatches() const
+{
+    std::vector<std::pair<const Folder *, const std::string *>> order;
+    for (auto &[rel, f] : folders)
+        order.push_back({&f, &rel});
+    // Top level patches come first, then each folder in order
+    std::sort(order.begin(), order.end(),
+              [](const auto &a, const auto &b)
+              {
+                  if (a.second->empty() != b.second->empty())
+                      return a.second->empty();
+                  return a.first->sortKey < b.first->sortKey;
+              });
+
+    std::vector<Patch> res;
+    std::vector<const Entry *> ents;
+    for (auto &[f, rel] : order)
+    {
+        ents.clear();
+        for (auto &e : f->entries)
+            ents.push_back(&e);
+        std::sort(ents.begin(), ents.end(),
+                  [](auto *a, auto *b) { return a->sortKey < b->sortKey; });
+
+        auto dir = rel->empty() ? fs::path() : fs::u8path(*rel);
+        for (auto *e : ents)
+            res.push_back({dir / fs::u8path(e->name), e});
+    }
+    return res;
+}
+
+bool PresetIndex::save() const
+{
+    Out o;
+    o.buf.append(indexMagic, sizeof(indexMagic));
+    o.u32(indexVersion);
+    o.u32(nElfinParams);
+    o.u32((uint32_t)folders.size());
+    for (auto &[rel, f] : folders)
+    {
+        o.str(rel);
+        o.u64((uint64_t)f.mtime);
+        o.u32((uint32_t)f.subfolders.size());
+        for (auto &s : f.subfolders)
+            o.str(s);
+        o.u32((uint32_t)f.entries.size());
+        for (auto &e : f.entries)
+        {
+            o.str(e.name);
+            o.u64((uint64_t)e.mtime);
+            o.u64(e.size);
+            o.buf.push_back((char)e.valid);
+            for (auto v : e.ccs)
+                o.buf.push_back((char)(int8_t)v);
+        }
+    }
+    o.u32(checksumFNV1a((const uint8_t *)o.buf.data(), o.buf.size()));
+
+    // Write aside and move in to place so a crash, or another instance writing at
+    // the same time, can't leave half an index
+    std::error_code ec;
+    auto target = root / indexFileName;
+    auto tmp = target;
+    tmp += uniqueTempSuffix();
+    bool written{false};
+    {
+        std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!f.is_open())
+            return false;
+        f.write(o.buf.data(), (std::streamsize)o.buf.size());
+        written = f.good();
+    }
+    if (written)
+        fs::rename(tmp, target, ec);
+    if (!written || ec)
+    {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool PresetIndex::load()
+{
+    folders.clear();
+
+    std::ifstream f(root / indexFileName, std::ios::in | std::ios::binary);
+    if (!f.is_open())
+        return false;
+    std::string s((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    auto *d = (const uint8_t *)s.data();
+    if (s.size() < sizeof(indexMagic) + 16 ||
+        std::memcmp(d, indexMagic, sizeof(indexMagic)) != 0)
+        return false;
+
+    In in{d, s.size() - 4};
+    in.pos = sizeof(indexMagic);
+    if (checksumFNV1a(d, in.end) != (In{d + in.end, 4}).u32())
+    {
+        ELFLOG("Preset index is damaged; rescanning");
+        return false;
+    }
+    if (in.u32() != indexVersion || in.u32() != nElfinParams)
+        return false;
+
+    auto nFolders = in.u32();
+    for (uint32_t i = 0; i < nFolders && in.ok; ++i)
+    {
+        auto rel = in.str();
+        Folder fo;
+        fo.sortKey = folderSortKey(rel);
+        fo.mtime = (int64_t)in.u64();
+        auto nSub = in.u32();
+        for (uint32_t j = 0; j < nSub && in.ok; ++j)
+            fo.subfolders.push_back(in.str());
+        auto nEnt = in.u32();
+        for (uint32_t j = 0; j < nEnt && in.ok; ++j)
+        {
+            Entry e;
+            e.name = in.str();
+            e.sortKey = naturalSortKey(e.name);
+            e.mtime = (int64_t)in.u64();
+            e.size = in.u64();
+            e.valid = in.u8() != 0;
+            for (auto &v : e.ccs)
+                v = (int8_t)in.u8();
+            fo.entries.push_back(std::move(e));
+        }
+        folders[rel] = std::move(fo);
+    }
+
+    if (!in.ok)
+        folders.clear();
+    return in.ok;
+}
+} // namespace baconpaul::elfin_controller
@@ -0,0 +1,127 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_PRESETINDEX_H
+#define ELFIN_CONTROLLER_PRESETINDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <filesystem/import.h>
+
+#include "PatchCodec.h"
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * What we know about the user patch folder, kept on disk between runs so opening
+ * the editor doesn't walk and parse the whole library. Each folder remembers its
+ * mtime and listing; a folder whose mtime hasn't moved isn't listed again (adding,
+ * removing or renaming a file touches its folder), and a file whose size and mtime
+ * haven't moved isn't parsed again.
+ *
+ * The index belongs to one thread at a time. PresetManager runs it on its scan
+ * thread.
+ */
+struct PresetIndex
+{
+    static constexpr const char *indexFileName{".elfin-preset-index"};
+
+    struct Entry
+    {
+        std::string name; // filename in its folder
+        std::string sortKey;
+        int64_t mtime{0};
+        uint64_t size{0};
+        bool valid{false};
+        PatchCCs ccs{emptyPatchCCs()};
+    };
+
+    struct Folder
+    {
+        std::string sortKey;
+        int64_t mtime{0};
+        std::vector<std::string> subfolders;
+        std::vector<Entry> entries;
+    };
+
+    explicit PresetIndex(const fs::path &r) : root(r) {}
+
+    // Read and write the index file in root. A missing or damaged index just
+    // means the next update does a full scan.
+    bool load();
+    bool save() const;
+
+    // Bring the index up to date with the disk. Returns true if anything changed.
+    // Setting stop abandons the walk part way, leaving the index as it was.
+    bool update(const std::atomic<bool> &stop);
+
+    /*
+     * Bring just these folders up to date, for when a watcher tells us where to
+     * look. Subfolders we already know are left to their own events, new ones are
+     * scanned and ones which went away are dropped, along with their contents. What
+     * that means for the patch list is appended to changes.
+     */
+    struct Change
+    {
+        enum Kind
+        {
+            ADDED,
+            REMOVED,
+            UPDATED
+        } kind;
+        fs::path path; // relative to root
+        PatchCCs ccs;
+        int64_t mtime{0};
+        uint64_t size{0};
+    };
+    void updateFolders(const std::vector<std::string> &rels, std::vector<Change> &changes,
+                       const std::atomic<bool> &stop);
+
+    struct Patch
+    {
+        fs::path path; // relative to root
+        const Entry *entry{nullptr};
+    };
+    // Every patch, top level first then by folder, each in natural order
+    std::vector<Patch> sortedPatches() const;
+
+    /*
+     * A key where a plain string compare gives the natural, case insensitive order,
+     * so sorting doesn't convert and rescan names on every comparison. Runs of
+     * digits become their digit count and then the digits.
+     */
+    static std::string naturalSortKey(const std::string &s);
+    // As above with the folder separator ordered below every other character
+    static std::string folderSortKey(const std::string &rel);
+
+    // The mtime and size we compare to tell whether a file changed. False if the
+    // file can't be looked at.
+    static bool statFile(const fs::path &p, int64_t &mtime, uint64_t &size);
+
+    fs::path root;
+    std::map<std::string, Folder> folders; // keyed by generic path relative to root
+
+  protected:
+    // Scan rel and, if recurseKnown, every folder below it. If not, only the
+    // subfolders we have never seen.
+    bool scanFolder(const std::string &rel, std::map<std::string, Folder> &into,
+                    const std::atomic<bool> &stop, bool recurseKnown = true);
+    void dropFolder(const std::string &rel, std::vector<Change> &changes);
+    static fs::path patchPath(const std::string &rel, const std::string &name);
+    static void readEntry(const fs::path &p, Entry &e);
+};
+} // namespace baconpaul::elfin_controller
+#endif // PRESETINDEX_H
@@ -12,155 +12,316 @@
  */
 
 #include "PresetManager.h"
-#include "sst/plugininfra/strnatcmp.h"
-#include <cmrc/cmrc.hpp>
-
-CMRC_DECLARE(elfin_content);
+#include "PresetWatcher.h"
+#include <tuple>
 
 namespace baconpaul::elfin_controller
 {
-void PresetManager::loadFactoryPresets()
+PresetManager::~PresetManager()
+{
+    {
+        std::lock_guard<std::mutex> g(scanMutex);
+        stopScan = true;
+    }
+    scanCV.notify_one();
+    if (scanThread.joinable())
+        scanThread.join();
+}
+
+void PresetManager::rescanUserPresets()
 {
-    ELFLOG("Loading factory presets");
-    try
     {
-        auto fs = cmrc::elfin_content::get_filesystem();
-        cmrc::directory_iterator dir = fs.iterate_directory(factoryPath);
-        for (const auto &q : dir)
+        std::lock_guard<std::mutex> g(scanMutex);
+        scanRequested = true;
+    }
+    scanCV.notify_one();
+}
+
+void PresetManager::scanUserPresets()
+{
+    PresetIndex index(userPatchesPath);
+    PresetWatcher watcher(userPatchesPath);
+
+    auto publish = [this, &index]()
+    {
+        auto sorted = index.sortedPatches();
+        std::vector<fs::path> paths;
+        std::vector<PatchCCs> ccs;
+        std::vector<FileStamp> stamps;
+        paths.reserve(sorted.size());
+        ccs.reserve(sorted.size());
+        stamps.reserve(sorted.size());
+        for (auto &p : sorted)
         {
-            std::vector<std::string> ents;
+            paths.push_back(std::move(p.path));
+            ccs.push_back(p.entry->ccs);
+            stamps.push_back({p.entry->mtime, p.entry->size});
+        }
 
-            if (q.is_directory())
-            {
-                for (const auto &patch :
-                     fs.iterate_directory(std::string() + factoryPath + "/" + q.filename()))
-                {
-                    ents.push_back(patch.filename());
-                }
+        std::lock_guard<std::mutex> g(scanMutex);
+        scannedPatches = std::move(paths);
+        scannedCCs = std::move(ccs);
+        scannedStamps = std::move(stamps);
+        scannedChanges.clear();
+        scannedFull = true;
+        scanReady.store(true, std::memory_order_release);
+    };
+    auto publishChanges = [this](std::vector<PresetIndex::Change> &changes)
+    {
+        std::lock_guard<std::mutex> g(scanMutex);
+        for (auto &c : changes)
+            scannedChanges.push_back(std::move(c));
+        scanReady.store(true, std::memory_order_release);
+    };
+    auto watchIndex = [&index, &watcher]()
+    {
+        std::vector<std::string> rels;
+        for (auto &[k, f] : index.folders)
+            rels.push_back(k);
+        return watcher.setFolders(rels);
+    };
+    auto save = [this, &index]()
+    {
+        if (!index.save())
+            ELFLOG("Unable to save preset index in " << userPatchesPath.u8string());
+    };
 
-                std::sort(ents.begin(), ents.end(),
-                          [](const auto &a, const auto &b)
-                          { return strnatcasecmp(a.c_str(), b.c_str()) < 0; });
-                factoryPatchNames[q.filename()] = ents;
+    // Show what we knew last time straight away, then catch up with the disk
+    bool published{false}, fullScan{true};
+    if (index.load())
+    {
+        publish();
+        published = true;
+    }
+
+    std::vector<std::string> recheck;
+    while (!stopScan)
+    {
+        if (fullScan)
+        {
+            fullScan = false;
+            if (index.update(stopScan))
+            {
+                publish();
+                save();
+            }
+            else if (!stopScan && !published)
+            {
+                publish();
             }
+            published = true;
+            watchIndex();
         }
-
-        factoryPatchVector.clear();
-        for (const auto &[c, st] : factoryPatchNames)
+        else
         {
-            for (const auto &pn : st)
+            bool overflowed{false};
+            auto changed = watcher.poll(overflowed);
+            if (overflowed)
             {
-                factoryPatchVector.emplace_back(c, pn);
+                fullScan = true;
+                continue;
+            }
+            changed.insert(changed.end(), recheck.begin(), recheck.end());
+            recheck.clear();
+            if (!changed.empty())
+            {
+                std::vector<PresetIndex::Change> changes;
+                index.updateFolders(changed, changes, stopScan);
+                if (!changes.empty() && !stopScan)
+                {
+                    publishChanges(changes);
+                    save();
+                }
+                recheck = watchIndex();
             }
         }
 
-        int32_t pidx = (int32_t)(1);
-        for (auto &[path, pname] : factoryPatchVector)
+        std::unique_lock<std::mutex> lk(scanMutex);
+        scanCV.wait_for(lk, watchInterval, [this]() { return scanRequested || stopScan; });
+        if (scanRequested)
         {
-            factoryPatchTree[path].push_back({pname, pidx});
-            pidx++;
+            scanRequested = false;
+            fullScan = true;
         }
     }
-    catch (const std::exception &e)
-    {
-        ELFLOG(e.what());
-    }
 }
 
-std::string PresetManager::factoryXMLFor(int idx) const
+bool PresetManager::takeUserScan()
 {
-    try
+    std::lock_guard<std::mutex> g(scanMutex);
+    if (!scanReady)
+        return false;
+    scanReady = false;
+
+    if (scannedFull)
     {
-        auto fs = cmrc::elfin_content::get_filesystem();
-        auto [path, name] = factoryPatchVector[idx];
-        auto f = fs.open(std::string() + factoryPath + "/" + path + "/" + name);
-        return std::string(f.begin(), f.end());
+        scannedFull = false;
+        userPatches = std::move(scannedPatches);
+        userPatchCCs = std::move(scannedCCs);
+        userPatchStamps = std::move(scannedStamps);
+        scannedPatches.clear();
+        scannedCCs.clear();
+        scannedStamps.clear();
+
+        userPatchTree.clear();
+        for (auto &p : userPatches)
+            userPatchTree[p.parent_path()].push_back({p, 0});
     }
-    catch (const std::exception &e)
+
+    for (auto &c : scannedChanges)
+        applyUserPatchChange(c);
+    scannedChanges.clear();
+
+    renumberUserPatchTree();
+    catalogueGeneration++;
+    return true;
+}
+
+bool PresetManager::currentUserPatchCCs(size_t idx, PatchCCs &into) const
+{
+    if (idx >= userPatches.size())
+        return false;
+    auto &ccs = userPatchCCs[idx];
+    if (std::all_of(ccs.begin(), ccs.end(), [](auto c) { return c < 0; }))
+        return false;
+
+    int64_t mtime;
+    uint64_t size;
+    auto &st = userPatchStamps[idx];
+    if (!PresetIndex::statFile(userPatchesPath / userPatches[idx], mtime, size) ||
+        mtime != st.mtime || size != st.size)
+        return false;
+
+    into = ccs;
+    return true;
+}
+
+int32_t PresetManager::presetIndexForName(const std::string &name)
+{
+    if (nameIndexGeneration != catalogueGeneration)
     {
-        ELFLOG(e.what());
+        indexByName.clear();
+        indexByName.reserve(numFactoryPatches() + userPatches.size());
+        // emplace keeps the first patch with a name, as a search in order would
+        int32_t idx{1};
+        for (size_t i = 0; i < numFactoryPatches(); ++i)
+            indexByName.emplace(factory_bank::nameOf(factoryPatch(i)), idx++);
+        // User patches go by their path in the user folder, as getNameFor shows them
+        for (auto p : userPatches)
+            indexByName.emplace(p.replace_extension().u8string(), idx++);
+        nameIndexGeneration = catalogueGeneration;
     }
-    return "";
+
+    auto it = indexByName.find(name);
+    return it == indexByName.end() ? -1 : it->second;
 }
 
-void PresetManager::recurseUserPresetFrom(const fs::path &p)
+const PatchSimilarity &PresetManager::similarity()
 {
-    if (fs::is_directory(p))
+    if (similarityGeneration != catalogueGeneration)
     {
-        for (auto &el : fs::directory_iterator(p))
-        {
-            auto elp = el.path();
-            if (elp.filename() == "." || elp.filename() == "..")
-            {
-                continue;
-            }
-            if (fs::is_directory(elp))
-            {
-                recurseUserPresetFrom(elp);
-            }
-            else if (fs::is_regular_file(elp) &&
-                     (elp.extension() == ".elfin" || elp.extension() == ".syx"))
-            {
-                auto pushP = elp.lexically_relative(userPatchesPath);
-                userPatches.push_back(pushP);
-            }
-        }
+        std::vector<PatchCCs> factory;
+        factory.reserve(numFactoryPatches());
+        for (size_t i = 0; i < numFactoryPatches(); ++i)
+            factory.push_back(factoryPatchCCs(i));
+        similarityIndex.build(factory, userPatchCCs);
+        similarityGeneration = catalogueGeneration;
     }
+    return similarityIndex;
 }
 
-void PresetManager::rescanUserPresets()
+namespace
 {
-    userPatches.clear();
-    try
-    {
-        recurseUserPresetFrom(userPatchesPath);
-        std::sort(userPatches.begin(), userPatches.end(),
-                  [](const fs::path &a, const fs::path &b)
-                  {
-                      auto appe = a.parent_path().empty();
-                      auto bppe = b.parent_path().empty();
-
-                      if (appe && bppe)
-                      {
-                          return strnatcasecmp(a.filename().u8string().c_str(),
-                                               b.filename().u8string().c_str()) < 0;
-                      }
-                      else if (appe)
-                      {
-                          return true;
-                      }
-                      else if (bppe)
-                      {
-                          return false;
-                      }
-                      else
-                      {
-                          return a < b;
-                      }
-                  });
+// The order PresetIndex::sortedPatches gives: top level first, then by folder,
+// then by name, all natural
+struct UserPatchOrder
+{
+    bool inFolder;
+    std::string folder, name;
+
+    explicit UserPatchOrder(const fs::path &p)
+    {
+        auto par = p.parent_path().generic_u8string();
+        inFolder = !par.empty();
+        folder = PresetIndex::folderSortKey(par);
+        name = PresetIndex::naturalSortKey(p.filename().u8string());
+    }
+    bool operator<(const UserPatchOrder &o) const
+    {
+        return std::tie(inFolder, folder, name) < std::tie(o.inFolder, o.folder, o.name);
     }
-    catch (fs::filesystem_error &)
+};
+} // namespace
+
+void PresetManager::applyUserPatchChange(const PresetIndex::Change &c)
+{
+    UserPatchOrder key(c.path);
+    auto it = std::lower_bound(userPatches.begin(), userPatches.end(), key,
+                               [](const fs::path &p, const UserPatchOrder &k)
+                               { return UserPatchOrder(p) < k; });
+    // Names like "a1" and "a01" sort together, so look through the tie
+    auto at = it;
+    while (at != userPatches.end() && *at != c.path && !(key < UserPatchOrder(*at)))
+        ++at;
+    bool present = at != userPatches.end() && *at == c.path;
+
+    auto &folder = userPatchTree[c.path.parent_path()];
+    auto inFolder = std::find_if(folder.begin(), folder.end(),
+                                 [&c](const auto &e) { return e.first == c.path; });
+
+    if (c.kind == PresetIndex::Change::REMOVED)
     {
+        if (present)
+        {
+            auto pos = at - userPatches.begin();
+            userPatchCCs.erase(userPatchCCs.begin() + pos);
+            userPatchStamps.erase(userPatchStamps.begin() + pos);
+            userPatches.erase(at);
+        }
+        if (inFolder != folder.end())
+            folder.erase(inFolder);
+        if (folder.empty())
+            userPatchTree.erase(c.path.parent_path());
+        return;
     }
 
-    int32_t pidx = (int32_t)(1 + factoryPatchVector.size());
-    userPatchTree.clear();
-    for (auto &p : userPatches)
+    if (present)
     {
-        userPatchTree[p.parent_path()].push_back({p, pidx});
-        pidx++;
+        auto pos = at - userPatches.begin();
+        userPatchCCs[pos] = c.ccs;
+        userPatchStamps[pos] = {c.mtime, c.size};
+        return;
     }
 
-#if 0
-    for (const auto &[k, v] : userPatchTree)
+    auto pos = it - userPatches.begin();
+    userPatches.insert(it, c.path);
+    userPatchCCs.insert(userPatchCCs.begin() + pos, c.ccs);
+    userPatchStamps.insert(userPatchStamps.begin() + pos, {c.mtime, c.size});
+
+    // The folder's patches are a run of userPatches, so keep the same order here
+    auto fpos = std::lower_bound(folder.begin(), folder.end(), key,
+                                 [](const auto &e, const UserPatchOrder &k)
+                                 { return UserPatchOrder(e.first) < k; });
+    folder.insert(fpos, {c.path, 0});
+}
+
+void PresetManager::renumberUserPatchTree()
+{
+    // Each folder is a contiguous run of userPatches, so walk them in step
+    int32_t pidx = (int32_t)(1 + numFactoryPatches());
+    size_t i{0};
+    while (i < userPatches.size())
     {
-        ELFLOG("K/V = '" << k.u8string() << "'");
-        for (const auto &p : v)
+        auto f = userPatchTree.find(userPatches[i].parent_path());
+        if (f == userPatchTree.end() || f->second.empty())
         {
-            ELFLOG("    - " << p.first.u8string() << " / " << p.second);
+            ELFLOG("User patch tree is out of step with the patch list");
+            break;
         }
+        for (auto &e : f->second)
+            e.second = pidx++;
+        i += f->second.size();
     }
-#endif
 }
 
 } // namespace baconpaul::elfin_controller
\ No newline at end of file
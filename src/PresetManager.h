@@ -14,16 +14,27 @@
 #ifndef ELFIN_CONTROLLER_PRESETMANAGER_H
 #define ELFIN_CONTROLLER_PRESETMANAGER_H
 
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <string>
 #include <functional>
 #include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <filesystem/import.h>
 #include "sst/jucegui/data/Discrete.h"
 
 #include "configuration.h"
+#include "PatchCodec.h"
+#include "PresetIndex.h"
+#include "PatchSimilarity.h"
+#include "FactoryBank.h"
 
 namespace baconpaul::elfin_controller
 {
@@ -38,25 +49,92 @@ struct PresetManager
     // Call with a null host to be read-only
     PresetManager(const fs::path &p)
     {
-        loadFactoryPresets();
         userPatchesPath = p;
-        rescanUserPresets();
+        scanThread = std::thread([this]() { scanUserPresets(); });
     }
-    ~PresetManager() {}
+    ~PresetManager();
 
-    void loadFactoryPresets();
+    /*
+     * The user patches are scanned on a background thread against an index kept in
+     * the user folder, so the first results come from the index and a rescan only
+     * looks at what changed. After that the thread watches the folders and updates
+     * the index for just the ones which change. The lists below belong to the
+     * message thread: ask for a rescan here, and when userScanReady says there is
+     * news, takeUserScan swaps in a full scan or applies the adds, removes and
+     * edits to the lists and tree in place.
+     */
     void rescanUserPresets();
-    void recurseUserPresetFrom(const fs::path &);
+    bool userScanReady() const { return scanReady.load(std::memory_order_acquire); }
+    bool takeUserScan();
 
-    std::string factoryXMLFor(int idx) const;
+    /*
+     * The factory patches are the table elfin-bankgen packs at build time, in
+     * category then natural name order. Preset index 1 + i is factory patch i.
+     */
+    static size_t numFactoryPatches() { return factory_bank::nPatches; }
+    static const factory_bank::Patch &factoryPatch(size_t i) { return factory_bank::patches[i]; }
+    static PatchCCs factoryPatchCCs(size_t i) { return factory_bank::ccsOf(factoryPatch(i)); }
 
-    static constexpr const char *factoryPath{"resources/content/patch_library"};
-    std::map<std::string, std::vector<std::string>> factoryPatchNames;
-    std::vector<std::pair<std::string, std::string>> factoryPatchVector;
+    /*
+     * Every factory and user patch as a similarity index, numbered like the
+     * catalogue (so one less than the preset index). It is built the first time it
+     * is asked for after the catalogue changes.
+     */
+    const PatchSimilarity &similarity();
+
+    // The preset index of the first patch, factory then user, with this display name
+    // (as PresetDataBinding::getNameFor gives it), or -1. Restoring a session's
+    // preset goes through here. The map behind it is rebuilt the first time it is
+    // asked for after the catalogue changes.
+    int32_t presetIndexForName(const std::string &name);
+
+    // Bumped whenever the user patch lists below change, so views of the catalogue
+    // know when to rebuild
+    uint64_t catalogueGeneration{0};
     std::vector<fs::path> userPatches;
+    // The CCs of each user patch, from the index. -1s if it couldn't be read.
+    std::vector<PatchCCs> userPatchCCs;
+    // The mtime and size each user patch had when its CCs were read
+    struct FileStamp
+    {
+        int64_t mtime{0};
+        uint64_t size{0};
+    };
+    std::vector<FileStamp> userPatchStamps;
+
+    /*
+     * The CCs of user patch idx as the catalogue has them, if the file still has the
+     * mtime and size they were read at, so stepping through presets costs a stat
+     * rather than a read and parse. An edit the watcher hasn't caught up with fails
+     * the check, and then the caller should read the file.
+     */
+    bool currentUserPatchCCs(size_t idx, PatchCCs &into) const;
 
     std::map<fs::path, std::vector<std::pair<fs::path, int32_t>>> userPatchTree;
-    std::map<std::string, std::vector<std::pair<std::string, int32_t>>> factoryPatchTree;
+
+  protected:
+    void scanUserPresets();
+    void applyUserPatchChange(const PresetIndex::Change &c);
+    void renumberUserPatchTree();
+
+    static constexpr std::chrono::milliseconds watchInterval{250};
+
+    PatchSimilarity similarityIndex;
+    uint64_t similarityGeneration{~0ull};
+
+    std::unordered_map<std::string, int32_t> indexByName;
+    uint64_t nameIndexGeneration{~0ull};
+
+    std::thread scanThread;
+    std::mutex scanMutex;
+    std::condition_variable scanCV;
+    bool scanRequested{false};
+    std::atomic<bool> stopScan{false}, scanReady{false};
+    bool scannedFull{false};
+    std::vector<fs::path> scannedPatches;
+    std::vector<PatchCCs> scannedCCs;
+    std::vector<FileStamp> scannedStamps;
+    std::vector<PresetIndex::Change> scannedChanges;
 };
 
 struct PresetDataBinding : sst::jucegui::data::Discrete
@@ -88,23 +166,24 @@ struct PresetDataBinding : sst::jucegui::data::Discrete
             return extraName;
 
         std::string postfix = isDirty ? " *" : "";
-
+        return getNameFor(i) + postfix;
+    }
+    // The name of the patch at preset index i, without the dirty marker
+    std::string getNameFor(int i) const
+    {
         if (i == 0)
-            return "Init" + postfix;
+            return "Init";
         auto fp = i - 1;
-        if (fp < pm.factoryPatchVector.size())
+        if (fp < pm.numFactoryPatches())
         {
-            fs::path p{pm.factoryPatchVector[fp].second};
-            // p = p / pm.factoryPatchVector[fp].second;
-            p = p.replace_extension("");
-            return p.u8string() + postfix;
+            return factory_bank::nameOf(pm.factoryPatch(fp));
         }
-        fp -= pm.factoryPatchVector.size();
+        fp -= pm.numFactoryPatches();
         if (fp < pm.userPatches.size())
         {
             auto pt = pm.userPatches[fp];
             pt = pt.replace_extension("");
-            return pt.u8string() + postfix;
+            return pt.u8string();
         }
         return "ERR";
     }
@@ -122,11 +201,11 @@ struct PresetDataBinding : sst::jucegui::data::Discrete
             return;
         }
         auto fp = f - 1;
-        if (fp < pm.factoryPatchVector.size())
+        if (fp < pm.numFactoryPatches())
         {
             onLoad(1, fp, {});
         }
-        fp -= pm.factoryPatchVector.size();
+        fp -= pm.numFactoryPatches();
         if (fp < pm.userPatches.size())
         {
             auto pt = pm.userPatchesPath / pm.userPatches[fp];
@@ -137,58 +216,47 @@ struct PresetDataBinding : sst::jucegui::data::Discrete
     int getMin() const override { return hasExtra ? -1 : 0; }
     int getMax() const override
     {
-        return 1 + pm.factoryPatchVector.size() + pm.userPatches.size() - 1 + (hasExtra ? 1 : 0);
+        return 1 + pm.numFactoryPatches() + pm.userPatches.size() - 1 + (hasExtra ? 1 : 0);
     } // last -1 is because inclusive
 
     void setDirtyState(bool b) { isDirty = b; }
 
-    void setStateForDisplayName(const std::string &s)
+    // The user patch at the current index, if that's what it is, so we can find it
+    // again after the user patches are rescanned
+    fs::path selectedUserPatch() const
+    {
+        auto up = curr - 1 - (int)pm.numFactoryPatches();
+        if (up >= 0 && up < (int)pm.userPatches.size())
+            return pm.userPatches[up];
+        return {};
+    }
+    void reselectUserPatch(const fs::path &p)
     {
-        auto q = getValueAsString();
-        auto sp = q.find("/");
-        if (sp != std::string::npos)
+        if (p.empty())
+            return;
+        auto it = std::find(pm.userPatches.begin(), pm.userPatches.end(), p);
+        if (it != pm.userPatches.end())
         {
-            q = q.substr(sp + 1);
+            setValueFromModel(1 + pm.numFactoryPatches() + (it - pm.userPatches.begin()));
         }
+        else
+        {
+            setExtra(p.filename().replace_extension("").u8string());
+            setValueFromModel(-1);
+        }
+    }
 
-        if (s == "Init")
+    void setStateForDisplayName(const std::string &s)
+    {
+        auto idx = s == "Init" ? 0 : pm.presetIndexForName(s);
+        if (idx >= 0)
         {
-            setValueFromModel(0);
+            setValueFromModel(idx);
         }
         else
         {
-            bool found{false};
-            int idx{1};
-            for (const auto &[c, pp] : pm.factoryPatchVector)
-            {
-                auto p = pp.substr(0, pp.find(".sxsnp"));
-                if (p == s)
-                {
-                    setValueFromModel(idx);
-                    found = true;
-                    break;
-                }
-                idx++;
-            }
-            if (!found)
-            {
-                for (auto &p : pm.userPatches)
-                {
-                    auto pn = p.filename().replace_extension("").u8string();
-                    if (s == pn)
-                    {
-                        setValueFromModel(idx);
-                        found = true;
-                        break;
-                    }
-                    idx++;
-                }
-            }
-            if (!found)
-            {
-                setExtra(s);
-                setValueFromModel(-1);
-            }
+            setExtra(s);
+            setValueFromModel(-1);
         }
     }
 };
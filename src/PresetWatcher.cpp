@@ -0,0 +1,181 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#include "PresetWatcher.h"
+
+#include <set>
+
+#include "PresetIndex.h"
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace baconpaul::elfin_controller
+{
+namespace
+{
+int64_t folderMTime(const fs::path &p)
+{
+    std::error_code ec;
+    auto t = fs::last_write_time(p, ec);
+    return ec ? -1 : (int64_t)t.time_since_epoch().count();
+}
+
+bool isOurIndex(const char *name)
+{
+    // The index and its temporary both start with the index name
+    return std::string(name).rfind(PresetIndex::indexFileName, 0) == 0;
+}
+} // namespace
+
+PresetWatcher::PresetWatcher(const fs::path &r) : root(r)
+{
+#if defined(__linux__)
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        ELFLOG("No inotify, so polling the user patches");
+#endif
+}
+
+PresetWatcher::~PresetWatcher()
+{
+#if defined(__linux__)
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+std::vector<std::string> PresetWatcher::setFolders(const std::vector<std::string> &rels)
+{
+    std::vector<std::string> added;
+    auto pathFor = [this](const std::string &rel)
+    { return rel.empty() ? root : root / fs::u8path(rel); };
+
+    if (!isNative())
+    {
+        std::map<std::string, int64_t> next;
+        for (auto &r : rels)
+        {
+            auto it = polledMTime.find(r);
+            if (it == polledMTime.end())
+                added.push_back(r);
+            next[r] = it != polledMTime.end() ? it->second : folderMTime(pathFor(r));
+        }
+        polledMTime = std::move(next);
+        return added;
+    }
+
+#if defined(__linux__)
+    std::set<std::string> want(rels.begin(), rels.end());
+    for (auto it = watchByFolder.begin(); it != watchByFolder.end();)
+    {
+        if (want.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        inotify_rm_watch(fd, it->second);
+        folderByWatch.erase(it->second);
+        it = watchByFolder.erase(it);
+    }
+    for (auto &r : want)
+    {
+        if (watchByFolder.count(r))
+            continue;
+        auto wd = inotify_add_watch(fd, pathFor(r).c_str(),
+                                    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                        IN_CLOSE_WRITE | IN_DELETE_SELF | IN_ONLYDIR);
+        if (wd < 0)
+            continue;
+        // A folder can come back with the watch of one we already had, if it moved
+        auto prior = folderByWatch.find(wd);
+        if (prior != folderByWatch.end())
+            watchByFolder.erase(prior->second);
+        folderByWatch[wd] = r;
+        watchByFolder[r] = wd;
+        added.push_back(r);
+    }
+#endif
+    return added;
+}
+
+std::vector<std::string> PresetWatcher::poll(bool &needsFullScan)
+{
+    std::set<std::string> changed;
+    needsFullScan = false;
+
+    if (!isNative())
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastPoll < pollInterval)
+            return {};
+        lastPoll = now;
+
+        for (auto &[r, mt] : polledMTime)
+        {
+            auto cur = folderMTime(r.empty() ? root : root / fs::u8path(r));
+            if (cur != mt)
+            {
+                mt = cur;
+                changed.insert(r);
+            }
+        }
+        return {changed.begin(), changed.end()};
+    }
+
+#if defined(__linux__)
+    alignas(inotify_event) char buf[8192];
+    while (true)
+    {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+
+        for (char *p = buf; p < buf + n;)
+        {
+            auto *ev = reinterpret_cast<inotify_event *>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                needsFullScan = true;
+                continue;
+            }
+            auto f = folderByWatch.find(ev->wd);
+            if (f == folderByWatch.end())
+                continue;
+            if (ev->mask & IN_IGNORED)
+            {
+                watchByFolder.erase(f->second);
+                folderByWatch.erase(f);
+                continue;
+            }
+            if (ev->len > 0 && isOurIndex(ev->name))
+                continue;
+
+            // A folder deleting itself is news for its parent's listing too
+            changed.insert(f->second);
+            if (ev->mask & IN_DELETE_SELF)
+            {
+                auto sl = f->second.rfind('/');
+                changed.insert(sl == std::string::npos ? "" : f->second.substr(0, sl));
+            }
+        }
+    }
+#endif
+    return {changed.begin(), changed.end()};
+}
+} // namespace baconpaul::elfin_controller
@@ -0,0 +1,61 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_PRESETWATCHER_H
+#define ELFIN_CONTROLLER_PRESETWATCHER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <filesystem/import.h>
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * Tells the preset scan thread which user folders changed, so it can update just
+ * those. On Linux this is inotify on each folder. Elsewhere we poll the folder
+ * mtimes every pollInterval, which catches files being added, removed and renamed
+ * but not edited in place; a rescan still picks those up.
+ *
+ * Folders are generic paths relative to root, as in PresetIndex.
+ */
+struct PresetWatcher
+{
+    explicit PresetWatcher(const fs::path &root);
+    ~PresetWatcher();
+
+    bool isNative() const { return fd >= 0; }
+
+    // Watch exactly these folders. Returns the ones which are new to us, since
+    // anything which landed in them before the watch started was missed.
+    std::vector<std::string> setFolders(const std::vector<std::string> &rels);
+
+    // Never blocks. Returns the folders which changed since the last call. If the
+    // watcher lost track (the event queue overflowed) needsFullScan is set.
+    std::vector<std::string> poll(bool &needsFullScan);
+
+    static constexpr std::chrono::milliseconds pollInterval{2000};
+
+  protected:
+    fs::path root;
+    int fd{-1};
+    std::map<int, std::string> folderByWatch;
+    std::map<std::string, int> watchByFolder;
+
+    std::map<std::string, int64_t> polledMTime;
+    std::chrono::steady_clock::time_point lastPoll{};
+};
+} // namespace baconpaul::elfin_controller
+#endif // PRESETWATCHER_H
@@ -0,0 +1,103 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+#ifndef ELFIN_CONTROLLER_SPSCQUEUE_H
+#define ELFIN_CONTROLLER_SPSCQUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace baconpaul::elfin_controller
+{
+/*
+ * A single producer, single consumer ring. Capacity is a compile time power of two
+ * so each use sizes its own storage. Head and tail live on their own cache lines
+ * and each side keeps a cached copy of the other's index, so the common case is
+ * one relaxed load and one release store per batch. A push which doesn't fit is
+ * counted in overflows rather than silently vanishing.
+ *
+ * This carries hardware CCs from the audio thread to the message thread, which
+ * opens host gestures for the params they move. Edits going the other way don't
+ * use it. The audio thread only needs each param's latest value, and the
+ * ParamStore dirty mask gives it that with one exchange a block. The mask can't
+ * overflow and collapses a burst of edits to one send.
+ */
+template <typename T, size_t Capacity> class SPSCQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "SPSCQueue capacity must be a power of two");
+    static constexpr size_t mask{Capacity - 1};
+
+  public:
+    static constexpr size_t capacity{Capacity};
+
+    bool push(const T &item) { return push_n(&item, 1) == 1; }
+
+    // Producer side. Returns how many made it; the rest are counted as overflow.
+    size_t push_n(const T *items, size_t n)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (Capacity - (h - tailCache) < n)
+            tailCache = tail.load(std::memory_order_acquire);
+
+        auto room = Capacity - (h - tailCache);
+        auto count = n < room ? n : room;
+        for (size_t i = 0; i < count; ++i)
+            buffer[(h + i) & mask] = items[i];
+        head.store(h + count, std::memory_order_release);
+
+        if (count < n)
+            overflows.fetch_add(n - count, std::memory_order_relaxed);
+        return count;
+    }
+
+    bool pop(T &item) { return pop_n(&item, 1) == 1; }
+
+    // Consumer side. Returns how many were written to out.
+    size_t pop_n(T *out, size_t maxN)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (headCache - t < maxN)
+            headCache = head.load(std::memory_order_acquire);
+
+        auto avail = headCache - t;
+        auto count = maxN < avail ? maxN : avail;
+        for (size_t i = 0; i < count; ++i)
+            out[i] = buffer[(t + i) & mask];
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate from either side
+    size_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+
+    uint64_t getOverflowCount() const { return overflows.load(std::memory_order_relaxed); }
+
+  private:
+    alignas(64) std::atomic<size_t> head{0};
+    size_t tailCache{0}; // producer's view of tail
+
+    alignas(64) std::atomic<size_t> tail{0};
+    size_t headCache{0}; // consumer's view of head
+
+    alignas(64) std::atomic<uint64_t> overflows{0};
+    std::array<T, Capacity> buffer{};
+};
+} // namespace baconpaul::elfin_controller
+#endif // SPSCQUEUE_H
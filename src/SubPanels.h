@@ -439,7 +439,7 @@ struct EGPanel : BasePanel
 
     void toggleCompander()
     {
-        auto uv = main.processor.params[EG_ON_OFF]->getCC() >= 64;
+        auto uv = main.processor.params[EG_ON_OFF]->getDiscreteIndex() == 1;
         main.widgets[COMPANDER]->setEnabled(uv);
     }
 
@@ -581,7 +581,7 @@ struct SettingsPanel : BasePanel
 
     void resetUnison()
     {
-        auto uv = main.processor.params[POLY_UNI_MODE]->getCC() >= 64;
+        auto uv = main.processor.params[POLY_UNI_MODE]->getDiscreteIndex() == 1;
         main.widgets[UNI_DETUNE]->setEnabled(uv);
         main.widgets[KEY_ASSIGN_MODE]->setEnabled(uv);
     }
@@ -14,50 +14,18 @@
 #ifndef ELFIN_CONTROLLER_CONFIGURATION_H
 #define ELFIN_CONTROLLER_CONFIGURATION_H
 
-#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <array>
-#include <vector>
+#include <string>
 #include <iostream>
 
 namespace baconpaul::elfin_controller
 {
 inline static const std::string rightArrow = std::string("\u21E8") + " ";
 
-struct ElfinDescription
-{
-    std::string streaming_name{};
-    std::string name{}, label{};
-    int32_t midiCC{-1}, midiCCDefault{0};
-    bool isBipolar{false};
-
-    ElfinDescription() = default;
-    ElfinDescription(const std::string &s, const std::string &n, const std::string &l, int32_t m,
-                     int32_t ccDef, bool isBip = false)
-        : name(n), label(l), midiCC(m), midiCCDefault(ccDef), streaming_name(s), isBipolar(isBip)
-    {
-    }
-
-    int16_t midiCCStart{0}, midiCCEnd{127};
-    std::string midiCCStartLabel{}, midiCCEndLabel{};
-
-    struct LabeledMidiRange
-    {
-        LabeledMidiRange() {}
-        LabeledMidiRange(int f, int t, const std::string &l) : from(f), to(t), label(l) {}
-        int16_t from{-1}, to{-1};
-        std::string label{"err"};
-    };
-    std::vector<LabeledMidiRange> discreteRanges;
-    bool hasDiscreteRanges() const { return !discreteRanges.empty(); }
-
-    void setAsTwoStage(const std::string &lo, const std::string &hi)
-    {
-        discreteRanges.clear();
-        discreteRanges.emplace_back(0, 63, lo);
-        discreteRanges.emplace_back(64, 127, hi);
-    }
-};
-
 // This enum value doesn't stream. Its just for code readability
 enum ElfinControl
 {
@@ -113,9 +81,282 @@ enum ElfinControl
 
 static constexpr int nElfinParams = (int)ElfinControl::numElfinControlTypes;
 
-extern std::map<ElfinControl, ElfinDescription> elfinConfig;
+struct LabeledMidiRange
+{
+    int16_t from{-1}, to{-1};
+    const char *label{"err"};
+};
+
+// A view on a static array of ranges, so descriptions stay literal types
+struct LabeledMidiRanges
+{
+    const LabeledMidiRange *data{nullptr};
+    size_t count{0};
+
+    constexpr const LabeledMidiRange *begin() const { return data; }
+    constexpr const LabeledMidiRange *end() const { return data + count; }
+    constexpr size_t size() const { return count; }
+    constexpr bool empty() const { return count == 0; }
+    constexpr const LabeledMidiRange &operator[](size_t i) const { return data[i]; }
+};
+
+struct ElfinDescription
+{
+    ElfinControl control{numElfinControlTypes};
+    const char *streaming_name{""};
+    const char *name{""}, *label{""};
+    int32_t midiCC{-1}, midiCCDefault{0};
+    bool isBipolar{false};
+
+    // Sound critical params get on to the wire ahead of the rest in a busy block
+    bool isSoundCritical{false};
+
+    // Output thinning. maxCCRateHz caps how often we send this CC (0 is unlimited) and
+    // ccHysteresis is how far, in CC steps beyond the usual half step, a value has to
+    // move before we quantize it to a new CC. Keep it under 0.5 so exact CC sets land.
+    float maxCCRateHz{100.f};
+    float ccHysteresis{0.25f};
+
+    int16_t midiCCStart{0}, midiCCEnd{127};
+    const char *midiCCStartLabel{""}, *midiCCEndLabel{""};
+
+    LabeledMidiRanges discreteRanges{};
+    constexpr bool hasDiscreteRanges() const { return !discreteRanges.empty(); }
+
+    // For discrete params, which range each CC value falls in. Built with the
+    // table so the UI, constraints, morph and randomize never scan the ranges.
+    std::array<int8_t, 128> discreteIndexByCC{};
+
+    constexpr int discreteIndexFor(int cc) const { return discreteIndexByCC[cc & 0x7F]; }
+    constexpr const char *discreteLabelFor(int cc) const
+    {
+        return hasDiscreteRanges() ? discreteRanges[discreteIndexFor(cc)].label : "";
+    }
+    // The CC we send to select a range, which is its middle
+    constexpr int ccForDiscreteIndex(int i) const
+    {
+        auto &r = discreteRanges[i];
+        return (r.from + r.to) / 2;
+    }
+    // Move a CC to the middle of its range, leaving continuous params alone
+    constexpr int snapToDiscrete(int cc) const
+    {
+        return hasDiscreteRanges() ? ccForDiscreteIndex(discreteIndexFor(cc)) : cc;
+    }
+
+    constexpr ElfinDescription() = default;
+    constexpr ElfinDescription(ElfinControl c, const char *s, const char *n, const char *l,
+                               int32_t m, int32_t ccDef, bool isBip = false)
+        : control(c), streaming_name(s), name(n), label(l), midiCC(m), midiCCDefault(ccDef),
+          isBipolar(isBip)
+    {
+    }
+
+    // Switches have nothing to smooth and each change is a mode change on the
+    // device, so send them slowly and exactly
+    template <size_t N> constexpr ElfinDescription withRanges(const LabeledMidiRange (&r)[N]) const
+    {
+        auto res = *this;
+        res.discreteRanges = {r, N};
+        for (size_t i = 0; i < N; ++i)
+            for (int cc = r[i].from; cc <= r[i].to && cc < 128; ++cc)
+                res.discreteIndexByCC[cc] = (int8_t)i;
+        res.maxCCRateHz = 20.f;
+        res.ccHysteresis = 0.f;
+        return res;
+    }
+    constexpr ElfinDescription soundCritical() const
+    {
+        auto res = *this;
+        res.isSoundCritical = true;
+        return res;
+    }
+    constexpr ElfinDescription withCCRange(int16_t s, int16_t e, const char *sl = "",
+                                           const char *el = "") const
+    {
+        auto res = *this;
+        res.midiCCStart = s;
+        res.midiCCEnd = e;
+        res.midiCCStartLabel = sl;
+        res.midiCCEndLabel = el;
+        return res;
+    }
+};
+
+namespace ranges
+{
+inline constexpr LabeledMidiRange offOn[]{{0, 63, "Off"}, {64, 127, "On"}};
+inline constexpr LabeledMidiRange oscTarget[]{{0, 63, "1+2"}, {64, 127, "2"}};
+inline constexpr LabeledMidiRange polyUni[]{{0, 63, "Poly"}, {64, 127, "Unison"}};
+inline constexpr LabeledMidiRange osc12Type[]{
+    {0, 15, "Saw/Saw"},       {16, 39, "Saw/Square"},  {40, 63, "Saw/Noise"},
+    {64, 87, "Square/Noise"}, {88, 111, "Square/Saw"}, {112, 127, "Square/Square"}};
+inline constexpr LabeledMidiRange subType[]{
+    {0, 31, "Sine"}, {32, 95, "Noise"}, {96, 127, "Square"}};
+inline constexpr LabeledMidiRange lfoType[]{{0, 15, "Tri No KT"},
+                                            {16, 47, "Tri"},
+                                            {48, 79, "Saw"},
+                                            {80, 111, "Random"},
+                                            {112, 127, "Square"}};
+inline constexpr LabeledMidiRange keyAssign[]{
+    {0, 47, "Low"}, {48, 79, "Duo"}, {80, 111, "High"}, {112, 127, "Last"}};
+inline constexpr LabeledMidiRange keytrack[]{
+    {0, 32, "None"}, {33, 96, "Half"}, {97, 127, "Full"}};
+} // namespace ranges
+
+using ED = ElfinDescription;
+// Indexed by ElfinControl. The checks below hold this to the enum order.
+inline constexpr std::array<ElfinDescription, nElfinParams> elfinConfig{{
+    ED{OSC12_TYPE, "osc12_type", "Osc 1/2 Wave", "Wave", 24, 7}.withRanges(ranges::osc12Type),
+    ED{OSC12_MIX, "osc12_mix", "Osc 1/2 Mix", "Mix", 25, 64, true}.soundCritical(),
+    ED{OSC2_COARSE, "osc2_coarse", "Osc 2 Coarse", "Coarse", 20, 64, true},
+    ED{OSC2_FINE, "osc2_fine", "Osc 2 Fine", "Fine", 21, 64, true},
+
+    ED{SUB_TYPE, "sub_type", "Sub Wave", "Sub", 29, 15}.withRanges(ranges::subType),
+    ED{SUB_LEVEL, "sub_level", "Sub Level", "Level", 26, 0},
 
-void setupConfiguration();
+    ED{EG_TO_PITCH, "eg_to_pitch", "EG -> Pitch", "> Pitch", 104, 64, true},
+    ED{EG_TO_PITCH_TARGET, "eg_to_pitch_target", "Osc Pitch Target", "Osc Pitch Target", 105,
+       31}
+        .withRanges(ranges::oscTarget),
+
+    ED{FILT_CUTOFF, "filt_cutoff", "Filter Cutoff", "Cutoff", 16, 127}.soundCritical(),
+    ED{FILT_RESONANCE, "filt_resonance", "Filter Resonance", "Resonance", 17, 0}.soundCritical(),
+    ED{EG_TO_CUTOFF, "eg_to_cutoff", "Envelope -> Cutoff", "> Cutoff", 18, 64, true},
+
+    ED{EG_ON_OFF, "eg_onoff", "EG -> VCA", "> VCA", 31, 31}.withRanges(ranges::offOn),
+    ED{EG_A, "eg_a", "EG Attack", "Attack", 23, 0}.soundCritical(),
+    ED{EG_D, "eg_d", "EG Decay", "Decay", 19, 0}.soundCritical(),
+    ED{EG_S, "eg_s", "EG Sustain", "Sustain", 27, 127}.soundCritical(),
+    ED{EG_R, "eg_r", "EG Release", "Release", 28, 31}.withRanges(ranges::offOn),
+
+    ED{LFO_TYPE, "lfo_type", "LFO Wave", "Wave", 14, 7}.withRanges(ranges::lfoType),
+    ED{LFO_RATE, "lfo_rate", "LFO Rate", "Rate", 80, 64},
+    ED{LFO_TO_PITCH, "lfo_to_pitch", "LFO -> Pitch", "> Pitch", 82, 64, true},
+    ED{LFO_TO_CUTOFF, "lfo_to_cutoff", "LFO -> Cutoff", "> Cutoff", 83, 64, true},
+
+    ED{LFO_DEPTH, "lfo_depth", "LFO Depth", "Depth", 81, 127},
+    ED{EG_TO_LFORATE, "eg_to_rate", "EG -> LFO Rate", "> LFO Rate", 3, 64, true},
+    ED{LFO_TO_PITCH_TARGET, "lfo_to_pitch_tgt", "LFO Osc Pitch Target", "Osc Pitch Target", 9,
+       31}
+        .withRanges(ranges::oscTarget),
+    ED{LFO_FADE_TIME, "lfo_fade_time", "LFO Fade In", "Fade In", 15, 0},
+
+    ED{PBEND_RANGE, "pbend_range", "Pitch Bend Range", "Bend Range", 85, 2}.withCCRange(0, 30),
+    ED{PITCH_TO_CUTOFF, "pitch_to_cut", "Filter Keytrack", "Keytrack", 86, 16}.withRanges(
+        ranges::keytrack),
+    ED{EXP_TO_CUTOFF, "exp_to_cut", "Velocity -> Cutoff", "> Cutoff", 106, 0},
+    ED{EXP_TO_AMP_LEVEL, "exp_to_amp", "Velocity -> VCA", "> VCA", 107, 0},
+
+    ED{PORTA, "portamento", "Portamento", "Portamento", 22, 1},
+    ED{LEGATO, "legato", "Legato", "Legato", 30, 31}.withRanges(ranges::offOn),
+    ED{KEY_ASSIGN_MODE, "key_assign", "Key Assign", "Key Assign", 87, 119}.withRanges(
+        ranges::keyAssign),
+
+    ED{OSC_LEVEL, "osc_level", "Osc Level", "Osc Level", 108, 127}.soundCritical(),
+    ED{UNI_DETUNE, "uni_detune", "Unison Detune", "Detune", 109, 0},
+    ED{POLY_UNI_MODE, "poly_uni", "Poly Unison Mode", "Mode", 110, 31}.withRanges(
+        ranges::polyUni),
+    ED{DAMP_AND_ATTACK, "damp_and_attack", "EG Damping", "EG Damping", 111, 63}.withCCRange(
+        63, 127, "Off"),
+
+    ED{COMPANDER, "compander", "Compander", "Compander", 88, 0}.withRanges(ranges::offOn),
+}};
+
+namespace detail
+{
+constexpr bool sameString(const char *a, const char *b)
+{
+    while (*a && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+constexpr bool tableIsInEnumOrder()
+{
+    for (int i = 0; i < nElfinParams; ++i)
+        if (elfinConfig[i].control != i)
+            return false;
+    return true;
+}
+
+constexpr bool namesAreUnique()
+{
+    for (int i = 0; i < nElfinParams; ++i)
+        for (int j = i + 1; j < nElfinParams; ++j)
+            if (sameString(elfinConfig[i].streaming_name, elfinConfig[j].streaming_name))
+                return false;
+    return true;
+}
+
+constexpr bool ccsAreValidAndUnique()
+{
+    for (int i = 0; i < nElfinParams; ++i)
+    {
+        auto &d = elfinConfig[i];
+        if (d.midiCC < 0 || d.midiCC > 127 || d.midiCCDefault < 0 || d.midiCCDefault > 127)
+            return false;
+        for (int j = i + 1; j < nElfinParams; ++j)
+            if (d.midiCC == elfinConfig[j].midiCC)
+                return false;
+    }
+    return true;
+}
+
+// Discrete ranges run in order with no gaps and cover every CC
+constexpr bool rangesCoverAllCCs()
+{
+    for (auto &d : elfinConfig)
+    {
+        if (!d.hasDiscreteRanges())
+            continue;
+        int next{0};
+        for (auto &r : d.discreteRanges)
+        {
+            if (r.from != next || r.to < r.from)
+                return false;
+            next = r.to + 1;
+        }
+        if (next != 128)
+            return false;
+    }
+    return true;
+}
+
+constexpr std::array<int8_t, 128> makeControlByCC()
+{
+    std::array<int8_t, 128> res{};
+    for (auto &v : res)
+        v = -1;
+    for (auto &d : elfinConfig)
+        res[d.midiCC] = (int8_t)d.control;
+    return res;
+}
+} // namespace detail
+
+static_assert(detail::tableIsInEnumOrder(), "elfinConfig must be in ElfinControl order");
+static_assert(detail::namesAreUnique(), "Duplicate streaming name in elfinConfig");
+static_assert(detail::ccsAreValidAndUnique(), "Duplicate or out of range CC in elfinConfig");
+static_assert(detail::rangesCoverAllCCs(), "Discrete ranges must tile 0..127");
+
+// CC number to ElfinControl, or -1 for CCs which aren't ours
+inline constexpr std::array<int8_t, 128> controlByCC = detail::makeControlByCC();
+
+// The mapping between a param's normalized 0..1 value and its CC
+inline float floatForCC(int cc) { return std::clamp(cc / 127.f, 0.f, 1.f); }
+inline int ccForFloat(float f) { return std::clamp((int)std::round(f * 127), 0, 127); }
+
+// Like ccForFloat but sticks with the current CC until the value has moved clearly
+// past the rounding boundary, so dense automation doesn't flap
+inline int ccForFloatWithHysteresis(float f, int current, float hysteresis)
+{
+    if (std::fabs(f * 127.f - current) < 0.5f + hysteresis)
+        return current;
+    return ccForFloat(f);
+}
 
 #define ELFLOG(...) std::cout << __FILE__ << ":" << __LINE__ << " " << __VA_ARGS__ << std::endl
 
@@ -0,0 +1,234 @@
+/*
+ * Elfin Controller
+ *
+ * A small controller plugin for the Elfin 04 Polysynth
+ *
+ * Copyright 2025, Paul Walker and Various authors, as described in the github
+ * transaction log.
+ *
+ * This source repo is released under the MIT license
+ *
+ * The source code and license are at https://github.com/baconpaul/elfin-controller
+ */
+
+/*
+ * Packs the factory patch library into the tables FactoryBank.h declares. Every
+ * patch is read with the decoder the plugin uses for .elfin files, and a patch
+ * which doesn't read, or reads as nothing, fails the build rather than shipping.
+ *
+ * elfin-bankgen <patch library folder> <output .cpp>
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <filesystem/import.h>
+#include "sst/plugininfra/strnatcmp.h"
+
+#include "FactoryBank.h"
+#include "PatchCodec.h"
+
+namespace ec = baconpaul::elfin_controller;
+
+namespace
+{
+struct Pool
+{
+    std::string data;
+    std::map<std::string, size_t> at;
+
+    size_t intern(const std::string &s)
+    {
+        auto it = at.find(s);
+        if (it != at.end())
+            return it->second;
+        auto res = data.size();
+        data += s;
+        data += '\0';
+        at[s] = res;
+        return res;
+    }
+};
+
+// A literal per string, with octal escapes since they can't run on in to the next
+// character the way hex ones do
+std::string literal(const std::string &s)
+{
+    std::string res = "\"";
+    for (unsigned char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            res += '\\';
+            res += (char)c;
+        }
+        else if (c < 0x20 || c >= 0x7F)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\%03o", c);
+            res += buf;
+        }
+        else
+        {
+            res += (char)c;
+        }
+    }
+    return res + "\\0\"";
+}
+
+// For the comments, where a backslash could run on to the next line
+std::string commentSafe(const char *s)
+{
+    std::string res(s);
+    for (auto &c : res)
+        if (c == '\\' || (unsigned char)c < 0x20)
+            c = '?';
+    return res;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: elfin-bankgen <patch library folder> <output .cpp>" << std::endl;
+        return 2;
+    }
+    auto root = fs::path(argv[1]);
+    auto out = fs::path(argv[2]);
+
+    std::vector<std::string> errors;
+    auto fail = [&errors](const fs::path &p, const std::string &why)
+    { errors.push_back(p.u8string() + ": " + why); };
+
+    // Categories in name order and patches in natural order, as the menus show them
+    std::map<std::string, std::vector<std::string>> library;
+    std::error_code err;
+    for (auto &c : fs::directory_iterator(root, err))
+    {
+        if (!c.is_directory())
+        {
+            fail(c.path(), "is not in a category folder");
+            continue;
+        }
+        auto &names = library[c.path().filename().u8string()];
+        for (auto &f : fs::directory_iterator(c.path()))
+        {
+            if (!f.is_regular_file() || f.path().extension() != ".elfin")
+            {
+                fail(f.path(), "is not an .elfin patch");
+                continue;
+            }
+            names.push_back(f.path().filename().u8string());
+        }
+        std::sort(names.begin(), names.end(), [](const auto &a, const auto &b)
+                  { return strnatcasecmp(a.c_str(), b.c_str()) < 0; });
+    }
+    if (err)
+        fail(root, err.message());
+
+    Pool pool;
+    std::vector<ec::factory_bank::Category> categories;
+    std::vector<ec::factory_bank::Patch> patches;
+    for (auto &[cat, names] : library)
+    {
+        if (names.empty())
+        {
+            fail(root / fs::u8path(cat), "has no patches");
+            continue;
+        }
+
+        ec::factory_bank::Category c{};
+        c.name = (uint16_t)pool.intern(cat);
+        c.first = (uint16_t)patches.size();
+        c.count = (uint16_t)names.size();
+        for (auto &n : names)
+        {
+            auto p = root / fs::u8path(cat) / fs::u8path(n);
+            std::ifstream f(p, std::ios::in | std::ios::binary);
+            std::stringstream ss;
+            ss << f.rdbuf();
+
+            auto ccs = ec::emptyPatchCCs();
+            if (!f || !ec::decodeElfin(ss.str(), ccs))
+            {
+                fail(p, "does not read as an .elfin patch");
+                continue;
+            }
+            if (std::all_of(ccs.begin(), ccs.end(), [](auto v) { return v < 0; }))
+            {
+                fail(p, "sets none of the Elfin params");
+                continue;
+            }
+
+            ec::factory_bank::Patch pt{};
+            pt.name = (uint16_t)pool.intern(fs::path(n).replace_extension().u8string());
+            pt.category = (uint8_t)categories.size();
+            for (int i = 0; i < ec::nElfinParams; ++i)
+                pt.ccs[i] = ccs[i] < 0 ? ec::factory_bank::noValue : (uint8_t)ccs[i];
+            patches.push_back(pt);
+        }
+        categories.push_back(c);
+    }
+
+    if (categories.size() > 0xFF || patches.size() > 0xFFFF || pool.data.size() > 0xFFFF)
+        fail(root, "is too large for the factory bank tables");
+
+    if (!errors.empty())
+    {
+        for (auto &e : errors)
+            std::cerr << "elfin-bankgen: " << e << std::endl;
+        std::cerr << "elfin-bankgen: " << errors.size() << " problem(s) in the factory library"
+                  << std::endl;
+        return 1;
+    }
+
+    std::ostringstream o;
+    o << "// Generated by elfin-bankgen from the factory patch library. Do not edit.\n\n"
+      << "#include \"FactoryBank.h\"\n\n"
+      << "namespace baconpaul::elfin_controller::factory_bank\n{\n";
+
+    o << "const char strings[] =\n";
+    for (size_t s = 0; s < pool.data.size();)
+    {
+        auto e = pool.data.find('\0', s);
+        o << "    " << literal(pool.data.substr(s, e - s)) << "\n";
+        s = e + 1;
+    }
+    o << "    ;\n\n";
+
+    o << "const Category categories[] = {\n";
+    for (auto &c : categories)
+        o << "    {" << c.name << ", " << c.first << ", " << c.count << "}, // "
+          << commentSafe(pool.data.c_str() + c.name) << "\n";
+    o << "};\nconst size_t nCategories = " << categories.size() << ";\n\n";
+
+    o << "const Patch patches[] = {\n";
+    for (auto &p : patches)
+    {
+        o << "    {" << p.name << ", " << (int)p.category << ", {";
+        for (int i = 0; i < ec::nElfinParams; ++i)
+            o << (i ? ", " : "") << (int)p.ccs[i];
+        o << "}}, // " << commentSafe(pool.data.c_str() + p.name) << "\n";
+    }
+    o << "};\nconst size_t nPatches = " << patches.size() << ";\n"
+      << "} // namespace baconpaul::elfin_controller::factory_bank\n";
+
+    fs::create_directories(out.parent_path(), err);
+    std::ofstream of(out, std::ios::out | std::ios::binary);
+    of << o.str();
+    if (!of)
+    {
+        std::cerr << "elfin-bankgen: unable to write " << out.u8string() << std::endl;
+        return 1;
+    }
+    std::cout << "elfin-bankgen: packed " << patches.size() << " patches in "
+              << categories.size() << " categories" << std::endl;
+    return 0;
+}